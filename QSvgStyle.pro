@@ -1,13 +1,14 @@
 TEMPLATE = subdirs
 
 SUBDIRS += \
+  thirdparty/quazip \
   styleconfig \
   style \
   thirdparty/svgcleaner \
-  thirdparty/quazip \
   themebuilder \
   thememanager \
-  themes
+  themes \
+  bench
 
 CONFIG += \
   ordered
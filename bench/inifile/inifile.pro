@@ -0,0 +1,28 @@
+CONFIG += \
+  release \
+  warn_on \
+  qt \
+  console
+
+TARGET = qsvginibench
+DESTDIR = bin
+TEMPLATE = app
+
+QT += core gui widgets core5compat concurrent
+
+INCLUDEPATH += ../../styleconfig
+
+PRE_TARGETDEPS += \
+  ../../styleconfig/lib/libQSvgStyleConfig.a \
+  ../../thirdparty/quazip/lib/libquazip.a
+
+LIBS += \
+  ../../styleconfig/lib/libQSvgStyleConfig.a \
+  ../../thirdparty/quazip/lib/libquazip.a \
+  -lz
+
+DEFINES += QUAZIP_STATIC
+DEFINES += THEMES_DIR=\\\"$$PWD/../../themes\\\"
+
+SOURCES += \
+  main.cpp
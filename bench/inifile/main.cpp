@@ -0,0 +1,171 @@
+/***************************************************************************
+ *   Copyright (C) 2014 by Saïd LANKRI   *
+ *   said.lankri@gmail.com   *
+ *                                                                         *
+ *   This program is free software; you can redistribute it and/or modify  *
+ *   it under the terms of the GNU General Public License as published by  *
+ *   the Free Software Foundation; either version 2 of the License, or     *
+ *   (at your option) any later version.                                   *
+ *                                                                         *
+ *   This program is distributed in the hope that it will be useful,       *
+ *   but WITHOUT ANY WARRANTY; without even the implied warranty of        *
+ *   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the         *
+ *   GNU General Public License for more details.                          *
+ *                                                                         *
+ *   You should have received a copy of the GNU General Public License     *
+ *   along with this program; if not, write to the                         *
+ *   Free Software Foundation, Inc.,                                       *
+ *   59 Temple Place - Suite 330, Boston, MA  02111-1307, USA.             *
+ ***************************************************************************/
+
+/*
+ * Benchmark of the loading of theme configurations, through QSettings
+ * and through QSvgCachedSettings which uses QSvgIniFile.
+ *
+ * Each iteration opens a configuration file and reads all its values.
+ * Every iteration uses its own copy of the file: QSettings keeps the
+ * files it read in a process wide cache, and QSvgIniFile shares the
+ * instances of open files.
+ *
+ * Usage: qsvginibench [themes directory] [iterations]
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+
+#include <QCoreApplication>
+#include <QDebug>
+#include <QDir>
+#include <QDirIterator>
+#include <QElapsedTimer>
+#include <QFile>
+#include <QFileInfo>
+#include <QSettings>
+#include <QStringList>
+#include <QTemporaryDir>
+
+#include "QSvgCachedSettings.h"
+
+typedef struct {
+  QString group;
+  QString key;
+} entry_t;
+
+/* Returns the group/key pairs of the given configuration file */
+static QList<entry_t> configEntries(const QString &file)
+{
+  QList<entry_t> r;
+  QSettings s(file, QSettings::IniFormat);
+
+  Q_FOREACH(const QString &k, s.childKeys())
+    r << entry_t{QString(), k};
+
+  Q_FOREACH(const QString &g, s.childGroups()) {
+    s.beginGroup(g);
+    Q_FOREACH(const QString &k, s.childKeys())
+      r << entry_t{g, k};
+    s.endGroup();
+  }
+
+  return r;
+}
+
+/* Values compared between both implementations */
+static int valueLength(const QVariant &v)
+{
+  return v.toStringList().join(",").size();
+}
+
+int main(int argc, char *argv[])
+{
+  QCoreApplication app(argc,argv);
+
+  const QString dir = (argc > 1) ? QString::fromLocal8Bit(argv[1]) : QString(THEMES_DIR);
+  const int iterations = (argc > 2) ? qMax(1,atoi(argv[2])) : 20;
+
+  QStringList files;
+  QDirIterator it(dir, QStringList() << "*.cfg", QDir::Files, QDirIterator::Subdirectories);
+  while ( it.hasNext() )
+    files << it.next();
+  files.sort();
+
+  if ( files.isEmpty() ) {
+    qWarning() << "[QSvgStyle]" << "No theme configuration found in" << dir;
+    return 1;
+  }
+
+  QTemporaryDir tmp;
+  if ( !tmp.isValid() ) {
+    qWarning() << "[QSvgStyle]" << "Could not create a temporary directory";
+    return 1;
+  }
+
+  printf("%-32s %8s %15s %15s %8s\n", "theme", "keys", "QSettings(us)", "QSvgIniFile(us)", "speedup");
+
+  qint64 qsTotal = 0, siTotal = 0;
+  bool same = true;
+
+  for (int n=0; n<files.size(); n++) {
+    QFile f(files.at(n));
+    if ( !f.open(QIODevice::ReadOnly) )
+      continue;
+    const QByteArray data = f.readAll();
+    f.close();
+
+    const QList<entry_t> entries = configEntries(files.at(n));
+
+    // copies are made before measuring
+    QStringList qsFiles, siFiles;
+    for (int i=0; i<iterations; i++) {
+      qsFiles << tmp.filePath(QString("qs-%1-%2.cfg").arg(n).arg(i));
+      siFiles << tmp.filePath(QString("si-%1-%2.cfg").arg(n).arg(i));
+      Q_FOREACH(const QString &copy, QStringList() << qsFiles.last() << siFiles.last()) {
+        QFile c(copy);
+        if ( c.open(QIODevice::WriteOnly) )
+          c.write(data);
+      }
+    }
+
+    QElapsedTimer t;
+    qint64 qs = 0, si = 0;
+    qint64 qsLength = 0, siLength = 0;
+
+    for (int i=0; i<iterations; i++) {
+      t.start();
+      {
+        QSettings s(qsFiles.at(i), QSettings::IniFormat);
+        Q_FOREACH(const entry_t &e, entries)
+          qsLength += valueLength(s.value(e.group.isEmpty() ? e.key : e.group+"/"+e.key));
+      }
+      qs += t.nsecsElapsed();
+
+      t.start();
+      {
+        QSvgCachedSettings s(siFiles.at(i));
+        Q_FOREACH(const entry_t &e, entries)
+          siLength += valueLength(s.getRawValue(e.group, e.key));
+      }
+      si += t.nsecsElapsed();
+    }
+
+    if ( qsLength != siLength ) {
+      qWarning() << "[QSvgStyle]" << "Values differ for" << files.at(n);
+      same = false;
+    }
+
+    qsTotal += qs;
+    siTotal += si;
+
+    printf("%-32s %8lld %15.1f %15.1f %8.2f\n",
+           qPrintable(QFileInfo(files.at(n)).completeBaseName()),
+           (long long)entries.size(),
+           qs/1000.0/iterations, si/1000.0/iterations,
+           si > 0 ? (double)qs/si : 0.0);
+  }
+
+  printf("%-32s %8s %15.1f %15.1f %8.2f\n", "total", "",
+         qsTotal/1000.0/iterations, siTotal/1000.0/iterations,
+         siTotal > 0 ? (double)qsTotal/siTotal : 0.0);
+
+  return same ? 0 : 2;
+}
@@ -0,0 +1,14 @@
+CONFIG += \
+  release \
+  warn_on \
+  qt \
+  console
+
+TARGET = qsvglineeditbench
+DESTDIR = bin
+TEMPLATE = app
+
+QT += core gui widgets
+
+SOURCES += \
+  main.cpp
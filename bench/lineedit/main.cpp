@@ -0,0 +1,149 @@
+/***************************************************************************
+ *   Copyright (C) 2014 by Saïd LANKRI   *
+ *   said.lankri@gmail.com   *
+ *                                                                         *
+ *   This program is free software; you can redistribute it and/or modify  *
+ *   it under the terms of the GNU General Public License as published by  *
+ *   the Free Software Foundation; either version 2 of the License, or     *
+ *   (at your option) any later version.                                   *
+ *                                                                         *
+ *   This program is distributed in the hope that it will be useful,       *
+ *   but WITHOUT ANY WARRANTY; without even the implied warranty of        *
+ *   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the         *
+ *   GNU General Public License for more details.                          *
+ *                                                                         *
+ *   You should have received a copy of the GNU General Public License     *
+ *   along with this program; if not, write to the                         *
+ *   Free Software Foundation, Inc.,                                       *
+ *   59 Temple Place - Suite 330, Boston, MA  02111-1307, USA.             *
+ ***************************************************************************/
+
+/*
+ * Benchmark of line edit repaints while typing, with and without the
+ * composite cache of QSvgStyle.
+ *
+ * Text is typed into many line edits in turn. Each keystroke is followed
+ * by a synchronous repaint of the field, which is also what each caret
+ * blink costs. Without composites, each repaint renders the frame and
+ * the interior of the field from their SVG elements. With composites,
+ * it blits them.
+ *
+ * Usage: qsvglineeditbench [theme directory] [fields] [keystrokes]
+ *
+ * The QSvgStyle plugin must be installed. The builtin theme is used if
+ * no theme directory is given. Run with QT_QPA_PLATFORM=offscreen to
+ * measure without a display.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+
+#include <QApplication>
+#include <QDebug>
+#include <QDir>
+#include <QElapsedTimer>
+#include <QGridLayout>
+#include <QKeyEvent>
+#include <QLineEdit>
+#include <QStyle>
+#include <QStyleFactory>
+#include <QWidget>
+
+/* Types into each field, returns the time spent in nanoseconds */
+static qint64 typeInto(const QList<QLineEdit *> &fields, int keystrokes)
+{
+  QElapsedTimer t;
+  t.start();
+
+  Q_FOREACH(QLineEdit *f, fields) {
+    f->setFocus(Qt::OtherFocusReason);
+    f->clear();
+
+    for (int i=0; i<keystrokes; i++) {
+      const int k = i%26;
+      const QString text(QChar('a'+k));
+
+      QKeyEvent press(QEvent::KeyPress, Qt::Key_A+k, Qt::NoModifier, text);
+      QCoreApplication::sendEvent(f,&press);
+      QKeyEvent release(QEvent::KeyRelease, Qt::Key_A+k, Qt::NoModifier, text);
+      QCoreApplication::sendEvent(f,&release);
+
+      f->repaint();
+    }
+  }
+
+  return t.nsecsElapsed();
+}
+
+static void setUseCompositeCache(QStyle *style, bool val)
+{
+  QStyle::staticMetaObject.invokeMethod(style,"setUseCompositeCache",
+                                        Qt::DirectConnection,
+                                        Q_ARG(bool, val));
+}
+
+int main(int argc, char *argv[])
+{
+  QApplication app(argc,argv);
+
+  const QString theme = (argc > 1) ? QString::fromLocal8Bit(argv[1]) : QString();
+  const int count = (argc > 2) ? qMax(1,atoi(argv[2])) : 50;
+  const int keystrokes = (argc > 3) ? qMax(1,atoi(argv[3])) : 40;
+
+  QStyle *style = QStyleFactory::create("QSvgStyle");
+  if ( !style ) {
+    qWarning() << "[QSvgStyle]" << "Could not load QSvgStyle style";
+    return 1;
+  }
+
+  if ( !theme.isEmpty() ) {
+    const QDir dir(theme);
+    const QStringList cfg = dir.entryList(QStringList() << "*.cfg", QDir::Files);
+    const QStringList svg = dir.entryList(QStringList() << "*.svg" << "*.svgz", QDir::Files);
+    if ( cfg.isEmpty() || svg.isEmpty() ) {
+      qWarning() << "[QSvgStyle]" << "No theme found in" << theme;
+      return 1;
+    }
+
+    // NOTE use invokeMethod, this allows us to not link against libqsvgstyle.so
+    QStyle::staticMetaObject.invokeMethod(style,"loadCustomThemeConfig",
+                                          Qt::DirectConnection,
+                                          Q_ARG(QString, dir.filePath(cfg.first())));
+    QStyle::staticMetaObject.invokeMethod(style,"loadCustomSVG",
+                                          Qt::DirectConnection,
+                                          Q_ARG(QString, dir.filePath(svg.first())));
+  }
+
+  QApplication::setStyle(style);
+
+  QWidget window;
+  QGridLayout *layout = new QGridLayout(&window);
+  QList<QLineEdit *> fields;
+  for (int i=0; i<count; i++) {
+    QLineEdit *f = new QLineEdit(&window);
+    layout->addWidget(f, i/5, i%5);
+    fields << f;
+  }
+
+  window.show();
+  window.activateWindow();
+  QApplication::processEvents();
+
+  // SVG renderings of all the states are cached by a first pass, only
+  // the composites make a difference afterwards
+  setUseCompositeCache(style, false);
+  typeInto(fields, 2);
+  const qint64 without = typeInto(fields, keystrokes);
+
+  setUseCompositeCache(style, true);
+  typeInto(fields, 2);
+  const qint64 with = typeInto(fields, keystrokes);
+
+  const int repaints = count*keystrokes;
+  printf("%d fields, %d keystrokes each\n", count, keystrokes);
+  printf("%-24s %12.1f us per keystroke\n", "without composites", without/1000.0/repaints);
+  printf("%-24s %12.1f us per keystroke\n", "with composites", with/1000.0/repaints);
+  printf("%-24s %12.2f\n", "speedup", with > 0 ? (double)without/with : 0.0);
+
+  return 0;
+}
@@ -0,0 +1,237 @@
+/***************************************************************************
+ *   Copyright (C) 2014 by Saïd LANKRI   *
+ *   said.lankri@gmail.com   *
+ *                                                                         *
+ *   This program is free software; you can redistribute it and/or modify  *
+ *   it under the terms of the GNU General Public License as published by  *
+ *   the Free Software Foundation; either version 2 of the License, or     *
+ *   (at your option) any later version.                                   *
+ *                                                                         *
+ *   This program is distributed in the hope that it will be useful,       *
+ *   but WITHOUT ANY WARRANTY; without even the implied warranty of        *
+ *   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the         *
+ *   GNU General Public License for more details.                          *
+ *                                                                         *
+ *   You should have received a copy of the GNU General Public License     *
+ *   along with this program; if not, write to the                         *
+ *   Free Software Foundation, Inc.,                                       *
+ *   59 Temple Place - Suite 330, Boston, MA  02111-1307, USA.             *
+ ***************************************************************************/
+#include "QSvgAnimationScheduler.h"
+
+#include <QWidget>
+#include <QWindow>
+#include <QScreen>
+#include <QTimer>
+#include <QRegion>
+#include <QtMath>
+
+/* Clock interval in ms while all the animations are paused */
+#define PAUSED_INTERVAL 250
+
+QSvgAnimationScheduler::QSvgAnimationScheduler(QObject *parent)
+  : QObject(parent),
+    timer(nullptr),
+    lastTick(0)
+{
+  timer = new QTimer(this);
+  timer->setTimerType(Qt::PreciseTimer);
+  connect(timer,SIGNAL(timeout()), this,SLOT(slot_tick()));
+
+  clock.start();
+}
+
+QSvgAnimationScheduler::~QSvgAnimationScheduler()
+{
+}
+
+void QSvgAnimationScheduler::start(QWidget *widget, Animation a, int step)
+{
+  if ( !widget || isRunning(widget, a) )
+    return;
+
+  if ( !animations.contains(widget) )
+    connect(widget,SIGNAL(destroyed(QObject*)),
+            this,SLOT(slot_widgetDestroyed(QObject*)));
+
+  animation_t anim;
+  anim.elapsed = 0;
+  anim.step = qMax(1, step);
+  anim.paused = false;
+
+  animations[widget].insert(a, anim);
+
+  if ( !timer->isActive() )
+    lastTick = clock.elapsed();
+
+  reschedule();
+}
+
+void QSvgAnimationScheduler::stop(const QWidget *widget, Animation a)
+{
+  QWidget *w = const_cast<QWidget *>(widget);
+
+  QHash<QWidget *, QMap<int,animation_t> >::iterator it = animations.find(w);
+  if ( it == animations.end() )
+    return;
+
+  it.value().remove(a);
+  if ( it.value().isEmpty() ) {
+    disconnect(w,SIGNAL(destroyed(QObject*)),
+               this,SLOT(slot_widgetDestroyed(QObject*)));
+    animations.erase(it);
+  }
+
+  reschedule();
+}
+
+void QSvgAnimationScheduler::stopAll(const QWidget *widget)
+{
+  QWidget *w = const_cast<QWidget *>(widget);
+
+  if ( !animations.contains(w) )
+    return;
+
+  disconnect(w,SIGNAL(destroyed(QObject*)),
+             this,SLOT(slot_widgetDestroyed(QObject*)));
+  animations.remove(w);
+
+  reschedule();
+}
+
+bool QSvgAnimationScheduler::isRunning(const QWidget *widget, Animation a) const
+{
+  QHash<QWidget *, QMap<int,animation_t> >::const_iterator it =
+    animations.constFind(const_cast<QWidget *>(widget));
+
+  return (it != animations.constEnd()) && it.value().contains(a);
+}
+
+qint64 QSvgAnimationScheduler::elapsed(const QWidget *widget, Animation a) const
+{
+  QHash<QWidget *, QMap<int,animation_t> >::const_iterator it =
+    animations.constFind(const_cast<QWidget *>(widget));
+
+  if ( it == animations.constEnd() )
+    return 0;
+
+  return it.value().value(a).elapsed;
+}
+
+void QSvgAnimationScheduler::setUpdateRect(const QWidget *widget, Animation a, const QRect &r)
+{
+  QHash<QWidget *, QMap<int,animation_t> >::iterator it =
+    animations.find(const_cast<QWidget *>(widget));
+
+  if ( (it == animations.end()) || !it.value().contains(a) )
+    return;
+
+  it.value()[a].rect = r;
+}
+
+void QSvgAnimationScheduler::slot_tick()
+{
+  const qint64 now = clock.elapsed();
+  const qint64 delta = now-lastTick;
+  lastTick = now;
+
+  QHash<QWidget *, QMap<int,animation_t> >::iterator it;
+  for (it = animations.begin(); it != animations.end(); ++it) {
+    QWidget *w = it.key();
+    const bool exposed = isExposed(w);
+
+    QRegion dirty;
+
+    QMap<int,animation_t>::iterator ait;
+    for (ait = it.value().begin(); ait != it.value().end(); ++ait) {
+      animation_t &anim = ait.value();
+
+      if ( !exposed ) {
+        anim.paused = true;
+        continue;
+      }
+
+      // time spent paused does not count
+      if ( anim.paused ) {
+        anim.paused = false;
+        dirty += anim.rect.isValid() ? anim.rect : w->rect();
+        continue;
+      }
+
+      const qint64 before = anim.elapsed/anim.step;
+      anim.elapsed += delta;
+
+      // only repaint if the animation visually changed
+      if ( anim.elapsed/anim.step != before )
+        dirty += anim.rect.isValid() ? anim.rect : w->rect();
+    }
+
+    if ( !dirty.isEmpty() )
+      w->update(dirty);
+  }
+
+  reschedule();
+}
+
+void QSvgAnimationScheduler::slot_widgetDestroyed(QObject *o)
+{
+  // do not use qobject_cast, the widget is already partially destroyed
+  animations.remove(static_cast<QWidget *>(o));
+
+  reschedule();
+}
+
+bool QSvgAnimationScheduler::isExposed(const QWidget *widget)
+{
+  if ( !widget->isVisible() )
+    return false;
+
+  const QWidget *win = widget->window();
+  if ( win->isMinimized() )
+    return false;
+
+  const QWindow *handle = win->windowHandle();
+  if ( !handle || !handle->isExposed() )
+    return false;
+
+  // e.g. scrolled out or covered by sibling widgets
+  return !widget->visibleRegion().isEmpty();
+}
+
+int QSvgAnimationScheduler::frameDuration(const QWidget *widget)
+{
+  const QScreen *screen = widget->screen();
+  const qreal rate = screen ? screen->refreshRate() : 60;
+
+  return qMax(1, qFloor(1000/qMax<qreal>(rate, 1)));
+}
+
+void QSvgAnimationScheduler::reschedule()
+{
+  if ( animations.isEmpty() ) {
+    timer->stop();
+    return;
+  }
+
+  // smallest step of running animations, never faster than the fastest
+  // screen showing them
+  int step = -1, frame = -1;
+
+  QHash<QWidget *, QMap<int,animation_t> >::const_iterator it;
+  for (it = animations.constBegin(); it != animations.constEnd(); ++it) {
+    if ( !isExposed(it.key()) )
+      continue;
+
+    const int f = frameDuration(it.key());
+    frame = (frame < 0) ? f : qMin(frame, f);
+
+    Q_FOREACH(const animation_t &anim, it.value()) {
+      step = (step < 0) ? anim.step : qMin(step, anim.step);
+    }
+  }
+
+  const int interval = (step < 0) ? PAUSED_INTERVAL : qMax(step, frame);
+
+  if ( !timer->isActive() || (timer->interval() != interval) )
+    timer->start(interval);
+}
@@ -0,0 +1,129 @@
+/***************************************************************************
+ *   Copyright (C) 2014 by Saïd LANKRI   *
+ *   said.lankri@gmail.com   *
+ *                                                                         *
+ *   This program is free software; you can redistribute it and/or modify  *
+ *   it under the terms of the GNU General Public License as published by  *
+ *   the Free Software Foundation; either version 2 of the License, or     *
+ *   (at your option) any later version.                                   *
+ *                                                                         *
+ *   This program is distributed in the hope that it will be useful,       *
+ *   but WITHOUT ANY WARRANTY; without even the implied warranty of        *
+ *   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the         *
+ *   GNU General Public License for more details.                          *
+ *                                                                         *
+ *   You should have received a copy of the GNU General Public License     *
+ *   along with this program; if not, write to the                         *
+ *   Free Software Foundation, Inc.,                                       *
+ *   59 Temple Place - Suite 330, Boston, MA  02111-1307, USA.             *
+ ***************************************************************************/
+#ifndef QSVGANIMATIONSCHEDULER_H
+#define QSVGANIMATIONSCHEDULER_H
+
+#include <QObject>
+#include <QHash>
+#include <QMap>
+#include <QRect>
+#include <QElapsedTimer>
+
+class QWidget;
+class QTimer;
+
+/**
+ * @brief Style wide animation clock
+ *
+ * All the animations of the style are driven by a single timer whose
+ * interval adapts to the refresh rate of the screens showing animated
+ * widgets and to the step of the running animations: no frame is
+ * produced when no animation would change.
+ *
+ * Animations of widgets that are hidden, obscured or whose window is
+ * minimized or not exposed are paused: their time does not advance and
+ * they are not repainted. Each animation repaints only its update rect,
+ * as set by the painting code with @ref setUpdateRect.
+ */
+class QSvgAnimationScheduler : public QObject
+{
+  Q_OBJECT
+
+  public:
+    /**
+     * Animations that can run on a widget
+     */
+    enum Animation {
+      BusyProgressBar,
+      StateTransition,
+    };
+
+    QSvgAnimationScheduler(QObject *parent = 0);
+    virtual ~QSvgAnimationScheduler();
+
+    /**
+     * Starts the given animation on the given widget, if not already
+     * running. @ref step is the time in ms after which the animation
+     * visually changes
+     */
+    void start(QWidget *widget, Animation a, int step);
+
+    /**
+     * Stops the given animation on the given widget
+     */
+    void stop(const QWidget *widget, Animation a);
+
+    /**
+     * Stops all the animations of the given widget
+     */
+    void stopAll(const QWidget *widget);
+
+    /**
+     * Returns whether the given animation runs on the given widget
+     */
+    bool isRunning(const QWidget *widget, Animation a) const;
+
+    /**
+     * Returns the time in ms the given animation has been running,
+     * pauses excluded
+     */
+    qint64 elapsed(const QWidget *widget, Animation a) const;
+
+    /**
+     * Sets the part of the widget to repaint on each frame of the
+     * given animation. An invalid rect repaints the whole widget
+     */
+    void setUpdateRect(const QWidget *widget, Animation a, const QRect &r);
+
+  private slots:
+    /**
+     * Slot called on each clock tick
+     */
+    void slot_tick();
+    /**
+     * Slot called when an animated widget is destroyed
+     */
+    void slot_widgetDestroyed(QObject *o);
+
+  private:
+    typedef struct {
+      qint64 elapsed;
+      int step;
+      bool paused;
+      QRect rect;
+    } animation_t;
+
+    /* Returns whether the given widget can be seen on screen */
+    static bool isExposed(const QWidget *widget);
+
+    /* Returns the frame duration in ms of the screen showing the widget */
+    static int frameDuration(const QWidget *widget);
+
+    /* Starts, reschedules or stops the clock */
+    void reschedule();
+
+    QHash<QWidget *, QMap<int,animation_t> > animations;
+
+    QTimer *timer;
+    QElapsedTimer clock;
+    qint64 lastTick;
+};
+
+#endif // QSVGANIMATIONSCHEDULER_H
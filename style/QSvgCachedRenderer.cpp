@@ -20,15 +20,119 @@
 
 #include "QSvgCachedRenderer.h"
 
+#include <string.h>
+
 #include <QDebug>
 #include <QPainter>
+#include <QPaintEngine>
+#include <QImage>
+#include <QTransform>
+#include <QtMath>
 #include <QElapsedTimer>
+#include <QXmlStreamReader>
+#include <QCryptographicHash>
+#include <QRegularExpression>
+#include <QSet>
+#include <QThread>
+#include <QThreadStorage>
+#include <QSharedPointer>
+#include <QCoreApplication>
+#include <QMutexLocker>
+#include <QThreadPool>
+#include <QTimer>
+#include <QFile>
+#include <QFileInfo>
+#include <QDir>
+#include <QSaveFile>
+#include <QDataStream>
+#include <algorithm>
+#include <QWidget>
+#include <QtConcurrent>
+
+#include "ThemePackage.h"
+
+#define USAGE_PROFILE_MAGIC   0x51535550 /* "QSUP" */
+#define USAGE_PROFILE_VERSION 1
+
+namespace {
+  // usage profile entry
+  typedef struct {
+    int scaleKey;
+    QString elementId;
+    QSize size;
+    quint32 count;
+  } usage_t;
+
+  bool moreUsed(const usage_t &a, const usage_t &b)
+  {
+    return a.count > b.count;
+  }
+
+  /* Reads the given usage profile, returns false if it was recorded
+   * with another SVG file */
+  bool readUsageProfile(const QString &profile, const QString &svgFile,
+                        QList<usage_t> &entries)
+  {
+    QFile f(profile);
+    if ( !f.open(QIODevice::ReadOnly) )
+      return false;
+
+    QDataStream in(&f);
+    quint32 magic, version, count;
+    QString file;
+
+    in >> magic >> version >> file >> count;
+    if ( (magic != USAGE_PROFILE_MAGIC) || (version != USAGE_PROFILE_VERSION) ||
+         (file != svgFile) )
+      return false;
+
+    for (quint32 i=0; (i<count) && (in.status() == QDataStream::Ok); i++) {
+      usage_t u;
+      in >> u.scaleKey >> u.elementId >> u.size >> u.count;
+      entries << u;
+    }
+
+    if ( in.status() != QDataStream::Ok ) {
+      qWarning() << "[QSvgStyle]" << "Corrupted usage profile" << profile;
+      entries.clear();
+      return false;
+    }
+
+    return true;
+  }
+
+  // an element missed again at another size within this delay is being
+  // resized interactively
+  const int RESIZE_STORM_DELAY = 100;
+  // delay after the last stretched rendering before rendering exactly
+  const int RESIZE_SETTLE_DELAY = 150;
+
+  // renderers of a worker thread, by cached renderer
+  typedef struct {
+    int generation;
+    QSharedPointer<QSvgRenderer> renderer;
+  } thread_renderer_t;
+
+  QThreadStorage<QHash<const void *,thread_renderer_t> > threadRenderers;
+
+  QAtomicInt generations;
+}
 
 QSvgCachedRenderer::QSvgCachedRenderer()
   : renderer(NULL),
+    coldDelay(0),
+    coldTimer(NULL),
+    asyncMisses(false),
+    asyncPool(NULL),
+    asyncContext(NULL),
+    paintTarget(NULL),
+    placeholders(0),
+    settleTimer(NULL),
+    trackChanges(false),
     totalCacheHits(0), totalCacheMisses(0),
     totalSvgRenderTime(0), totalCachedRenderTime(0)
 {
+  clock.start();
 }
 
 QSvgCachedRenderer::QSvgCachedRenderer(const QString &file)
@@ -39,6 +143,18 @@ QSvgCachedRenderer::QSvgCachedRenderer(const QString &file)
 
 QSvgCachedRenderer::~QSvgCachedRenderer()
 {
+  // pending worker renderings refer to us
+  if ( asyncPool ) {
+    // warm-up renderings not started yet are useless now
+    asyncPool->clear();
+    asyncPool->waitForDone();
+    delete asyncPool;
+  }
+  // drops the deliveries not made yet
+  delete asyncContext;
+  delete settleTimer;
+  delete coldTimer;
+
   delete renderer;
 
   // If you want to dumpStats(), please uncomment the relevant
@@ -47,28 +163,208 @@ QSvgCachedRenderer::~QSvgCachedRenderer()
   //dumpStats();
 }
 
-bool QSvgCachedRenderer::load(const QString &file)
+bool QSvgCachedRenderer::load(const QString &filename)
 {
   if ( renderer )
     delete renderer;
 
   svgCache.clear();
+  rasters.clear();
+  opacity.clear();
+  pendingMisses.clear();
+  recentMisses.clear();
+  storming.clear();
+  for (int i=0; i<IMAGE_CACHE_SHARDS; i++) {
+    QMutexLocker l(&imageCache[i].mutex);
+    imageCache[i].entries.clear();
+  }
+  generation.storeRelease(generations.fetchAndAddOrdered(1)+1);
   totalCacheHits = totalCacheMisses = 0;
   totalSvgRenderTime = totalCachedRenderTime = 0;
 
+  file = filename;
+  fragmentHashes.clear();
+  if ( trackChanges ) {
+    QHash<QString,QStringList> refs;
+    hashFragments(ThemePackage::readSvgXml(file), fragmentHashes, refs);
+  }
+
   renderer = new QSvgRenderer();
 
+  // theme packages are decompressed into memory. Compressed SVG
+  // files (svgz) are handled by QSvgRenderer itself
+  if ( ThemePackage::isPackage(file) )
+    return renderer->load(ThemePackage::readSvg(file));
+
   return renderer->load(file);
 }
 
+void QSvgCachedRenderer::setTrackChanges(bool enabled)
+{
+  if ( enabled == trackChanges )
+    return;
+
+  trackChanges = enabled;
+  fragmentHashes.clear();
+
+  if ( trackChanges && !file.isEmpty() ) {
+    QHash<QString,QStringList> refs;
+    hashFragments(ThemePackage::readSvgXml(file), fragmentHashes, refs);
+  }
+}
+
+QStringList QSvgCachedRenderer::reload()
+{
+  QStringList changed;
+
+  if ( file.isEmpty() )
+    return changed;
+
+  if ( !trackChanges ) {
+    load(file);
+    return changed;
+  }
+
+  QHash<QString,QByteArray> hashes;
+  QHash<QString,QStringList> refs;
+  hashFragments(ThemePackage::readSvgXml(file), hashes, refs);
+
+  // elements whose own fragment changed, appeared or disappeared
+  QSet<QString> dirty;
+  QHash<QString,QByteArray>::const_iterator it;
+  for (it = hashes.constBegin(); it != hashes.constEnd(); ++it) {
+    if ( fragmentHashes.value(it.key()) != it.value() )
+      dirty.insert(it.key());
+  }
+  for (it = fragmentHashes.constBegin(); it != fragmentHashes.constEnd(); ++it) {
+    if ( !hashes.contains(it.key()) )
+      dirty.insert(it.key());
+  }
+
+  // elements referencing a changed element have changed too
+  bool grown = !dirty.isEmpty();
+  while ( grown ) {
+    grown = false;
+    QHash<QString,QStringList>::const_iterator rit;
+    for (rit = refs.constBegin(); rit != refs.constEnd(); ++rit) {
+      if ( dirty.contains(rit.key()) )
+        continue;
+      foreach (QString r, rit.value()) {
+        if ( dirty.contains(r) ) {
+          dirty.insert(rit.key());
+          grown = true;
+          break;
+        }
+      }
+    }
+  }
+
+  if ( dirty.isEmpty() )
+    return changed;
+
+  // QSvgRenderer can not be partially updated, but renderings
+  // of unchanged elements are kept
+  QHash<int,partition_t> kept;
+  QHash<int,partition_t>::const_iterator pit;
+  for (pit = svgCache.constBegin(); pit != svgCache.constEnd(); ++pit) {
+    partition_t &k = kept[pit.key()];
+    partition_t::const_iterator cit;
+    for (cit = pit.value().constBegin(); cit != pit.value().constEnd(); ++cit) {
+      if ( !dirty.contains(cit.key().section('@',0,0)) )
+        k.insert(cit.key(), cit.value());
+    }
+  }
+  QHash<QString,bool> keptOpacity = opacity;
+  foreach (QString d, dirty) {
+    keptOpacity.remove(d);
+  }
+
+  // hashes are already known, do not compute them again
+  trackChanges = false;
+  load(file);
+  trackChanges = true;
+
+  svgCache = kept;
+  purgeRasters();
+  opacity = keptOpacity;
+  fragmentHashes = hashes;
+  changed = dirty.values();
+
+  return changed;
+}
+
+void QSvgCachedRenderer::hashFragments(const QByteArray &xml,
+                                       QHash<QString,QByteArray> &hashes,
+                                       QHash<QString,QStringList> &refs)
+{
+  static const QRegularExpression refRx("url\\(\\s*#([^)\\s]+)\\s*\\)|href\\s*=\\s*[\"']#([^\"']+)[\"']");
+
+  // offsets given by the reader are offsets in the decoded text
+  const QString text = QString::fromUtf8(xml);
+  QXmlStreamReader reader(text);
+
+  // open elements having an id: id and start offset
+  QList<QPair<QString,qint64> > open;
+  // whether each open element has an id
+  QList<bool> hasId;
+  qint64 start = 0;
+
+  while ( !reader.atEnd() ) {
+    reader.readNext();
+
+    if ( reader.isStartElement() ) {
+      const QString id = reader.attributes().value("id").toString();
+      hasId.append(!id.isEmpty());
+      if ( !id.isEmpty() )
+        open.append(qMakePair(id, start));
+    } else if ( reader.isEndElement() ) {
+      if ( !hasId.isEmpty() && hasId.takeLast() ) {
+        const QPair<QString,qint64> e = open.takeLast();
+        const QStringView fragment = QStringView(text).mid(e.second, reader.characterOffset()-e.second);
+
+        hashes.insert(e.first, QCryptographicHash::hash(
+                        QByteArrayView(reinterpret_cast<const char *>(fragment.utf16()),
+                                       fragment.size()*sizeof(QChar)),
+                        QCryptographicHash::Md5));
+
+        QStringList &r = refs[e.first];
+        QRegularExpressionMatchIterator m = refRx.globalMatch(fragment);
+        while ( m.hasNext() ) {
+          const QRegularExpressionMatch match = m.next();
+          const QString ref = match.captured(1).isEmpty() ? match.captured(2) : match.captured(1);
+          if ( (ref != e.first) && !r.contains(ref) )
+            r << ref;
+        }
+      }
+    }
+
+    start = reader.characterOffset();
+  }
+
+  if ( reader.hasError() )
+    qWarning() << "[QSvgStyle]" << "Could not parse SVG file:" << reader.errorString();
+}
+
 void QSvgCachedRenderer::render(QPainter *painter, const QString &elementId, const QRect &bounds)
 {
-  if ( (bounds.width() > 250) || (bounds.height() > 250) ) {
-    // direct render, don't cache big items
+  // pixmaps can only be used in the GUI thread
+  if ( !isGuiThread() ) {
+    renderThreaded(painter,elementId,bounds);
+    return;
+  }
+
+  // Elements are rasterized at the physical resolution they are
+  // painted at, each scale having its own cache partition
+  const qreal scale = renderScale(painter);
+
+  if ( (scale <= 0) || (bounds.width() > 250) || (bounds.height() > 250) ) {
+    // direct render, don't cache big items nor rotated or sheared ones
     renderer->render(painter,elementId,bounds);
     return;
   }
 
+  partition_t &partition = svgCache[scaleKey(scale)];
+
   // key = elementId @ width x height
   const QString e = QString("%1@%2x%3")
       .arg(elementId)
@@ -78,12 +374,17 @@ void QSvgCachedRenderer::render(QPainter *painter, const QString &elementId, con
   QElapsedTimer t;
   int elapsed = 0;
 
-  if ( svgCache.contains(e) ) {
+  partition_t::iterator it = partition.find(e);
+  if ( it != partition.end() ) {
     totalCacheHits++;
 
     // dont use value() as this will return a copy
-    svgCacheEntry &entry = svgCache[e];
+    svgCacheEntry &entry = it.value();
     entry.hits++;
+    entry.lastUse = clock.elapsed();
+
+    if ( entry.pixmap.isNull() && !entry.packed.isEmpty() )
+      uncompressEntry(entry);
 
     // element found in cache
     t.restart();
@@ -109,36 +410,65 @@ void QSvgCachedRenderer::render(QPainter *painter, const QString &elementId, con
   } else {
     totalCacheMisses++;
 
+    // transient sizes of interactive resizes are not cached
+    if ( isResizeStorm(elementId) ) {
+      renderStretched(painter,elementId,bounds,scale);
+      return;
+    }
+
+    // do not block on SVG rendering if a placeholder can be drawn
+    if ( asyncMisses && renderAsync(painter,elementId,bounds,scale) )
+      return;
+
     // not found, add to cache
     svgCacheEntry entry;
     entry.hits = entry.svgRenderTime = entry.cachedRenderTime = 0;
+    entry.lastUse = clock.elapsed();
+    entry.prewarmed = false;
 
     // Penalty: because the original painter can contain all sorts of
-    // transformations, we must first render to a pixmap using a new
+    // transformations, we must first render to an image using a new
     // painter in order to get an unaltered element to reuse later
     // But this happens only on a miss (i.e. once per element@size)
-    entry.pixmap = QPixmap(bounds.size());
-    entry.pixmap.fill(Qt::transparent);
-    // warning: the pixmap must be drawn with a neutral painter
-    QPainter p(&entry.pixmap);
+    // The image is hashed before being uploaded to a pixmap, no readback
+    QImage image(bounds.size()*scale, QImage::Format_ARGB32_Premultiplied);
+    image.setDevicePixelRatio(scale);
+    image.fill(Qt::transparent);
+    // warning: the image must be drawn with a neutral painter
+    QPainter p(&image);
 
     t.restart();
     renderer->render(&p,elementId,QRect(QPoint(0,0),bounds.size()));
-    entry.mask = entry.pixmap.mask();
-    // save the mask
+    p.end();
+
+    bool opaque;
+    const QByteArray hash = rasterHash(image,&opaque);
+    if ( !shareRaster(entry,hash) ) {
+      entry.pixmap = QPixmap::fromImage(image);
+      // save the mask, in logical coordinates
+      entry.mask = entry.pixmap.mask();
+      if ( scale != 1.0 )
+        entry.mask = QTransform::fromScale(1.0/scale,1.0/scale).map(entry.mask);
+      addRaster(entry,hash);
+    }
     elapsed = t.elapsed();
 
+    // an element is opaque only if all its renderings are
+    if ( !opaque || !opacity.contains(elementId) )
+      opacity.insert(elementId, opaque);
+
     // now render the pixmap using the original painter
     painter->drawPixmap(bounds,entry.pixmap);
 
     entry.svgRenderTime += elapsed;
     totalSvgRenderTime += elapsed;
 
-    svgCache.insert(e,entry);
+    partition.insert(e,entry);
   }
 }
 
-QRegion QSvgCachedRenderer::elementRegion(const QString &elementId, const QRect &bounds)
+QRegion QSvgCachedRenderer::elementRegion(const QString &elementId, const QRect &bounds,
+                                          qreal scale)
 {
   // key = elementId @ width x height
   const QString e = QString("%1@%2x%3")
@@ -146,14 +476,792 @@ QRegion QSvgCachedRenderer::elementRegion(const QString &elementId, const QRect
       .arg(bounds.width())
       .arg(bounds.height());
 
-  if ( svgCache.contains(e) ) {
-    svgCacheEntry &entry = svgCache[e];
-    return QRegion(entry.mask).translated(bounds.x(),bounds.y());
+  if ( !isGuiThread() ) {
+    const QString k = QString("%1@%2").arg(e).arg(scaleKey(scale));
+    const uint shard = qHash(k) % IMAGE_CACHE_SHARDS;
+    QMutexLocker l(&imageCache[shard].mutex);
+    QHash<QString,imageCacheEntry>::const_iterator it =
+      imageCache[shard].entries.constFind(k);
+    if ( it != imageCache[shard].entries.constEnd() )
+      return it.value().mask.translated(bounds.x(),bounds.y());
+    return QRegion(bounds);
+  }
+
+  // Elements rendered directly (rotated painters, vector devices) have
+  // no cached raster: compute their mask at 1:1 scale. The mask is a set
+  // of rects, so clipping with it is still a vector operation
+  if ( scale <= 0 ) {
+    if ( !renderer || !bounds.isValid() || (bounds.width() > 250) || (bounds.height() > 250) )
+      return QRegion(bounds);
+
+    partition_t &partition = svgCache[scaleKey(1.0)];
+    partition_t::const_iterator it = partition.constFind(e);
+    if ( it == partition.constEnd() ) {
+      QPixmap px(bounds.size());
+      px.fill(Qt::transparent);
+      QPainter p(&px);
+      render(&p,elementId,QRect(QPoint(0,0),bounds.size()));
+      p.end();
+      it = partition.constFind(e);
+      if ( it == partition.constEnd() )
+        return QRegion(bounds);
+    }
+    return it.value().mask.translated(bounds.x(),bounds.y());
+  }
+
+  const partition_t &partition = svgCache[scaleKey(scale)];
+  partition_t::const_iterator it = partition.constFind(e);
+  if ( it != partition.constEnd() ) {
+    return it.value().mask.translated(bounds.x(),bounds.y());
   } else {
     return QRegion(bounds);
   }
 }
 
+void QSvgCachedRenderer::retainScales(const QList<qreal> &dprs)
+{
+  QSet<int> live;
+  foreach (qreal dpr, dprs) {
+    live.insert(scaleKey(dpr));
+  }
+
+  QHash<int,partition_t>::iterator it = svgCache.begin();
+  while ( it != svgCache.end() ) {
+    if ( !live.contains(it.key()) )
+      it = svgCache.erase(it);
+    else
+      ++it;
+  }
+
+  purgeRasters();
+}
+
+QByteArray QSvgCachedRenderer::rasterHash(const QImage &image, bool *opaque)
+{
+  QCryptographicHash h(QCryptographicHash::Sha1);
+  const qint32 header[3] = { image.width(), image.height(), (qint32)image.format() };
+  h.addData(QByteArrayView(reinterpret_cast<const char *>(header), sizeof(header)));
+  h.addData(QByteArray::number(image.devicePixelRatio()));
+
+  // renderings are ARGB32, other formats are checked separately
+  const bool argb = (image.format() == QImage::Format_ARGB32_Premultiplied) ||
+                    (image.format() == QImage::Format_ARGB32);
+  bool o = !image.isNull();
+
+  for (int y=0; y<image.height(); y++) {
+    h.addData(QByteArrayView(reinterpret_cast<const char *>(image.constScanLine(y)),
+                             image.bytesPerLine()));
+    if ( !opaque || !argb || !o )
+      continue;
+    const QRgb *line = reinterpret_cast<const QRgb *>(image.constScanLine(y));
+    for (int x=0; x<image.width(); x++) {
+      if ( qAlpha(line[x]) != 255 ) {
+        o = false;
+        break;
+      }
+    }
+  }
+
+  if ( opaque )
+    *opaque = argb ? o : isOpaque(image);
+
+  return h.result();
+}
+
+bool QSvgCachedRenderer::shareRaster(svgCacheEntry &entry, const QByteArray &hash)
+{
+  QHash<QByteArray,raster_t>::const_iterator it = rasters.constFind(hash);
+  if ( it == rasters.constEnd() )
+    return false;
+
+  // implicitly shared: no copy of the pixels nor of the mask
+  entry.pixmap = it.value().pixmap;
+  entry.mask = it.value().mask;
+  return true;
+}
+
+void QSvgCachedRenderer::addRaster(const svgCacheEntry &entry, const QByteArray &hash)
+{
+  raster_t r;
+  r.pixmap = entry.pixmap;
+  r.mask = entry.mask;
+  rasters.insert(hash,r);
+}
+
+void QSvgCachedRenderer::purgeRasters()
+{
+  // rasters no longer used by any entry are only referenced here
+  QHash<QByteArray,raster_t>::iterator it = rasters.begin();
+  while ( it != rasters.end() ) {
+    if ( it.value().pixmap.isDetached() )
+      it = rasters.erase(it);
+    else
+      ++it;
+  }
+}
+
+void QSvgCachedRenderer::setColdDelay(int minutes)
+{
+  coldDelay = qMax(0, minutes);
+
+  if ( coldDelay == 0 ) {
+    if ( coldTimer )
+      coldTimer->stop();
+    return;
+  }
+
+  if ( !coldTimer ) {
+    coldTimer = new QTimer();
+    QObject::connect(coldTimer, &QTimer::timeout, [this]() { compressColdEntries(); });
+  }
+
+  // entries become cold at most a minute late
+  coldTimer->start(60000);
+}
+
+void QSvgCachedRenderer::compressColdEntries()
+{
+  const qint64 now = clock.elapsed();
+  const qint64 limit = (qint64)coldDelay*60000;
+
+  // entries sharing a rendering share its compressed pixels
+  typedef struct {
+    QByteArray data;
+    QImage::Format format;
+  } packed_t;
+  QHash<qint64,packed_t> packed;
+
+  QHash<int,partition_t>::iterator p;
+  for (p = svgCache.begin(); p != svgCache.end(); ++p) {
+    partition_t::iterator it;
+    for (it = p.value().begin(); it != p.value().end(); ++it) {
+      svgCacheEntry &entry = it.value();
+      if ( entry.pixmap.isNull() || (now-entry.lastUse < limit) )
+        continue;
+
+      const qint64 key = entry.pixmap.cacheKey();
+      if ( !packed.contains(key) ) {
+        const QImage image = entry.pixmap.toImage();
+        packed_t k;
+        // pieces are mostly flat colors and transparent areas, which
+        // deflate very well
+        k.data = qCompress(image.constBits(), image.sizeInBytes(), 1);
+        k.format = image.format();
+        packed.insert(key,k);
+      }
+
+      entry.packed = packed.value(key).data;
+      entry.packedFormat = packed.value(key).format;
+      entry.packedSize = entry.pixmap.size();
+      entry.packedDpr = entry.pixmap.devicePixelRatio();
+      entry.pixmap = QPixmap();
+    }
+  }
+
+  // frees the pixmaps of the renderings no entry uses uncompressed
+  purgeRasters();
+}
+
+void QSvgCachedRenderer::uncompressEntry(svgCacheEntry &entry)
+{
+  QImage image(entry.packedSize, entry.packedFormat);
+  const QByteArray data = qUncompress(entry.packed);
+  if ( image.isNull() || (data.size() != image.sizeInBytes()) ) {
+    // should not happen, leaves a transparent rendering
+    qWarning() << "[QSvgStyle]" << "Could not uncompress cached rendering";
+    image = QImage(entry.packedSize, QImage::Format_ARGB32_Premultiplied);
+    image.fill(Qt::transparent);
+  } else {
+    memcpy(image.bits(), data.constData(), data.size());
+  }
+  image.setDevicePixelRatio(entry.packedDpr);
+
+  // other entries may have uncompressed the same rendering already
+  const QByteArray hash = rasterHash(image);
+  if ( !shareRaster(entry,hash) ) {
+    entry.pixmap = QPixmap::fromImage(image);
+    addRaster(entry,hash);
+  }
+
+  entry.packed.clear();
+}
+
+void QSvgCachedRenderer::memoryStats(quint64 &used, quint64 &saved) const
+{
+  QSet<qint64> seen;
+  used = saved = 0;
+
+  QHash<int,partition_t>::const_iterator p;
+  for (p = svgCache.constBegin(); p != svgCache.constEnd(); ++p) {
+    partition_t::const_iterator it;
+    for (it = p.value().constBegin(); it != p.value().constEnd(); ++it) {
+      const QPixmap &px = it.value().pixmap;
+      if ( px.isNull() ) {
+        used += it.value().packed.size();
+        continue;
+      }
+      const quint64 bytes = (quint64)px.width()*px.height()*px.depth()/8;
+      if ( seen.contains(px.cacheKey()) ) {
+        saved += bytes;
+      } else {
+        seen.insert(px.cacheKey());
+        used += bytes;
+      }
+    }
+  }
+}
+
+bool QSvgCachedRenderer::elementExists(const QString &id) const
+{
+  QSvgRenderer *r = isGuiThread() ? renderer : threadRenderer();
+  return r ? r->elementExists(id) : false;
+}
+
+bool QSvgCachedRenderer::isGuiThread()
+{
+  const QCoreApplication *app = QCoreApplication::instance();
+  return !app || (QThread::currentThread() == app->thread());
+}
+
+QSvgRenderer *QSvgCachedRenderer::threadRenderer() const
+{
+  return threadRenderer(this,file,generation.loadAcquire());
+}
+
+QSvgRenderer *QSvgCachedRenderer::threadRenderer(const void *owner,
+                                                 const QString &file,
+                                                 int g)
+{
+  if ( file.isEmpty() )
+    return NULL;
+
+  QHash<const void *,thread_renderer_t> &renderers = threadRenderers.localData();
+  thread_renderer_t &t = renderers[owner];
+
+  if ( !t.renderer || (t.generation != g) ) {
+    t.generation = g;
+    t.renderer.reset(new QSvgRenderer());
+    if ( ThemePackage::isPackage(file) )
+      t.renderer->load(ThemePackage::readSvg(file));
+    else
+      t.renderer->load(file);
+  }
+
+  return t.renderer.data();
+}
+
+void QSvgCachedRenderer::renderThreaded(QPainter *painter, const QString &elementId, const QRect &bounds)
+{
+  QSvgRenderer *r = threadRenderer();
+  if ( !r )
+    return;
+
+  const qreal scale = renderScale(painter);
+
+  if ( (scale <= 0) || (bounds.width() > 250) || (bounds.height() > 250) ) {
+    r->render(painter,elementId,bounds);
+    return;
+  }
+
+  // key = elementId @ width x height @ scale
+  const QString k = QString("%1@%2x%3@%4")
+      .arg(elementId)
+      .arg(bounds.width())
+      .arg(bounds.height())
+      .arg(scaleKey(scale));
+
+  // lookups only lock one shard, so that threads rarely wait
+  const uint shard = qHash(k) % IMAGE_CACHE_SHARDS;
+
+  QImage image;
+  {
+    QMutexLocker l(&imageCache[shard].mutex);
+    QHash<QString,imageCacheEntry>::const_iterator it =
+      imageCache[shard].entries.constFind(k);
+    if ( it != imageCache[shard].entries.constEnd() )
+      image = it.value().image;
+  }
+
+  if ( image.isNull() ) {
+    // rendered without holding the lock: another thread may render the
+    // same element meanwhile, the first one inserted is kept
+    imageCacheEntry entry;
+    entry.image = QImage(bounds.size()*scale, QImage::Format_ARGB32_Premultiplied);
+    entry.image.setDevicePixelRatio(scale);
+    entry.image.fill(Qt::transparent);
+    QPainter p(&entry.image);
+    r->render(&p,elementId,QRect(QPoint(0,0),bounds.size()));
+    p.end();
+    entry.mask = alphaRegion(entry.image);
+
+    QMutexLocker l(&imageCache[shard].mutex);
+    QHash<QString,imageCacheEntry>::const_iterator it =
+      imageCache[shard].entries.constFind(k);
+    if ( it == imageCache[shard].entries.constEnd() )
+      it = imageCache[shard].entries.insert(k,entry);
+    image = it.value().image;
+  }
+
+  painter->drawImage(bounds,image);
+}
+
+const QSvgCachedRenderer::svgCacheEntry *QSvgCachedRenderer::nearestEntry(
+    const partition_t &partition, const QString &elementId, const QSize &size) const
+{
+  const QString prefix = elementId+"@";
+  const svgCacheEntry *nearest = NULL;
+  int bestDistance = 0;
+
+  partition_t::const_iterator it;
+  for (it = partition.constBegin(); it != partition.constEnd(); ++it) {
+    // compressed renderings are too slow to be placeholders
+    if ( !it.key().startsWith(prefix) || it.value().pixmap.isNull() )
+      continue;
+    const QSize sz = it.value().pixmap.deviceIndependentSize().toSize();
+    const int d = qAbs(sz.width()-size.width())+qAbs(sz.height()-size.height());
+    if ( !nearest || (d < bestDistance) ) {
+      nearest = &it.value();
+      bestDistance = d;
+    }
+  }
+
+  return nearest;
+}
+
+void QSvgCachedRenderer::addPaintTarget(pending_t &pending, QPainter *painter,
+                                        const QRect &bounds) const
+{
+  if ( !paintTarget )
+    return;
+
+  QWidget *w = const_cast<QWidget *>(paintTarget);
+  QRect r;
+  if ( painter->device() == paintTarget )
+    r = painter->worldTransform().mapRect(bounds);
+
+  for (int i=0; i<pending.widgets.size(); i++) {
+    if ( pending.widgets.at(i) != w )
+      continue;
+    // one entry per widget, repainted as a whole if needed more than once
+    if ( pending.rects.at(i) != r )
+      pending.rects[i] = QRect();
+    return;
+  }
+
+  pending.widgets << QPointer<QWidget>(w);
+  pending.rects << r;
+}
+
+bool QSvgCachedRenderer::isResizeStorm(const QString &elementId)
+{
+  // stretched renderings could not be repainted exactly
+  if ( !paintTarget )
+    return false;
+
+  // the same element may be painted at several sizes by one widget,
+  // only a widget being resized is a storm
+  const QString k = QString("%1@%2").arg(elementId).arg((quintptr)paintTarget);
+
+  if ( storming.contains(k) ) {
+    // keeps stretching until no new size has been missed for a while
+    settleTimer->start();
+    return true;
+  }
+
+  // keys of deleted widgets are never reused
+  if ( recentMisses.size() > 1024 )
+    recentMisses.clear();
+
+  miss_t &m = recentMisses[k];
+  const QSize widgetSize = paintTarget->size();
+
+  // a single new size is rendered exactly
+  if ( !m.lastMiss.isValid() || (m.lastMiss.elapsed() > RESIZE_STORM_DELAY) ||
+       (m.lastSize == widgetSize) ) {
+    m.lastMiss.start();
+    m.lastSize = widgetSize;
+    return false;
+  }
+
+  m.lastMiss.start();
+  m.lastSize = widgetSize;
+  storming.insert(k);
+
+  if ( !settleTimer ) {
+    settleTimer = new QTimer();
+    settleTimer->setSingleShot(true);
+    settleTimer->setInterval(RESIZE_SETTLE_DELAY);
+    QObject::connect(settleTimer, &QTimer::timeout, [this]() { resizeSettled(); });
+  }
+  settleTimer->start();
+
+  return true;
+}
+
+void QSvgCachedRenderer::renderStretched(QPainter *painter, const QString &elementId,
+                                         const QRect &bounds, qreal scale)
+{
+  const svgCacheEntry *nearest = nearestEntry(svgCache[scaleKey(scale)],
+                                              elementId,bounds.size());
+  if ( nearest )
+    painter->drawPixmap(bounds,nearest->pixmap);
+  else
+    renderer->render(painter,elementId,bounds);
+
+  placeholders++;
+  addPaintTarget(stormTargets,painter,bounds);
+}
+
+void QSvgCachedRenderer::resizeSettled()
+{
+  // the next paints render and cache the final sizes
+  storming.clear();
+  recentMisses.clear();
+
+  const pending_t targets = stormTargets;
+  stormTargets = pending_t();
+
+  updatePending(targets);
+}
+
+void QSvgCachedRenderer::saveUsageProfile(const QString &profile, int max) const
+{
+  if ( file.isEmpty() )
+    return;
+
+  // key = scale / elementId@WxH
+  QHash<QString,usage_t> usage;
+
+  // older usage weighs half
+  QList<usage_t> old;
+  readUsageProfile(profile,file,old);
+  Q_FOREACH(const usage_t &u, old) {
+    if ( u.count < 2 )
+      continue;
+    usage_t &v = usage[QString("%1/%2@%3x%4").arg(u.scaleKey).arg(u.elementId)
+                       .arg(u.size.width()).arg(u.size.height())];
+    v = u;
+    v.count = u.count/2;
+  }
+
+  QHash<int,partition_t>::const_iterator p;
+  for (p = svgCache.constBegin(); p != svgCache.constEnd(); ++p) {
+    partition_t::const_iterator it;
+    for (it = p.value().constBegin(); it != p.value().constEnd(); ++it) {
+      const quint32 count = it.value().hits + (it.value().prewarmed ? 0 : 1);
+      if ( count == 0 )
+        continue;
+
+      usage_t &v = usage[QString("%1/%2").arg(p.key()).arg(it.key())];
+      if ( v.elementId.isEmpty() ) {
+        v.scaleKey = p.key();
+        v.elementId = it.key().section('@',0,-2);
+        // key = elementId@WxH
+        const QString sz = it.key().section('@',-1);
+        v.size = QSize(sz.section('x',0,0).toInt(),sz.section('x',1,1).toInt());
+        v.count = 0;
+      }
+      v.count += count;
+    }
+  }
+
+  QList<usage_t> entries = usage.values();
+  std::sort(entries.begin(), entries.end(), moreUsed);
+  if ( entries.size() > max )
+    entries.erase(entries.begin()+max, entries.end());
+
+  QDir().mkpath(QFileInfo(profile).absolutePath());
+
+  QSaveFile f(profile);
+  if ( !f.open(QIODevice::WriteOnly) )
+    return;
+
+  QDataStream out(&f);
+  out << (quint32)USAGE_PROFILE_MAGIC << (quint32)USAGE_PROFILE_VERSION
+      << file << (quint32)entries.size();
+
+  Q_FOREACH(const usage_t &u, entries)
+    out << u.scaleKey << u.elementId << u.size << u.count;
+
+  f.commit();
+}
+
+void QSvgCachedRenderer::warmUp(const QString &profile)
+{
+  QList<usage_t> entries;
+  if ( !readUsageProfile(profile,file,entries) )
+    return;
+
+  // entries are sorted by use count
+  Q_FOREACH(const usage_t &u, entries) {
+    if ( (u.scaleKey <= 0) || !u.size.isValid() ||
+         (u.size.width() > 250) || (u.size.height() > 250) )
+      continue;
+
+    const QString e = QString("%1@%2x%3")
+        .arg(u.elementId)
+        .arg(u.size.width())
+        .arg(u.size.height());
+    const QString k = QString("%1/%2").arg(u.scaleKey).arg(e);
+
+    if ( svgCache[u.scaleKey].contains(e) || pendingMisses.contains(k) )
+      continue;
+
+    pendingMisses.insert(k,pending_t());
+    queueRendering(u.elementId,u.size,u.scaleKey/100.0);
+  }
+}
+
+bool QSvgCachedRenderer::renderAsync(QPainter *painter, const QString &elementId,
+                                     const QRect &bounds, qreal scale)
+{
+  // a placeholder nobody repaints would stay, e.g. in icons
+  if ( !paintTarget )
+    return false;
+
+  const int sk = scaleKey(scale);
+  const svgCacheEntry *nearest = nearestEntry(svgCache[sk],elementId,bounds.size());
+
+  if ( !nearest )
+    return false;
+
+  painter->drawPixmap(bounds,nearest->pixmap);
+  placeholders++;
+
+  // remember who must be repainted once the rendering is ready
+  const QString e = QString("%1@%2x%3")
+      .arg(elementId)
+      .arg(bounds.width())
+      .arg(bounds.height());
+  const QString k = QString("%1/%2").arg(sk).arg(e);
+
+  const bool queued = pendingMisses.contains(k);
+  pending_t &pending = pendingMisses[k];
+  addPaintTarget(pending,painter,bounds);
+  pending.drawn = true;
+
+  if ( !queued )
+    queueRendering(elementId,bounds.size(),scale);
+
+  return true;
+}
+
+void QSvgCachedRenderer::queueRendering(const QString &elementId, const QSize &size,
+                                        qreal scale)
+{
+  if ( !asyncPool ) {
+    asyncPool = new QThreadPool();
+    asyncContext = new QObject();
+  }
+
+  // the worker does not touch this object, only its own renderer
+  const void *owner = this;
+  const QString f = file;
+  const int g = generation.loadAcquire();
+  const int sk = scaleKey(scale);
+  QObject *context = asyncContext;
+  QSvgCachedRenderer *self = this;
+
+  (void)QtConcurrent::run(asyncPool, [=]() {
+    QSvgRenderer *r = threadRenderer(owner,f,g);
+    if ( !r )
+      return;
+
+    QImage image(size*scale, QImage::Format_ARGB32_Premultiplied);
+    image.setDevicePixelRatio(scale);
+    image.fill(Qt::transparent);
+    QPainter p(&image);
+    r->render(&p,elementId,QRect(QPoint(0,0),size));
+    p.end();
+
+    // delivered in the GUI thread, dropped if we are deleted meanwhile
+    QMetaObject::invokeMethod(context, [=]() {
+      self->asyncRenderDone(elementId,size,sk,g,image);
+    }, Qt::QueuedConnection);
+  });
+}
+
+void QSvgCachedRenderer::asyncRenderDone(const QString &elementId, const QSize &size,
+                                         int sk, int g, const QImage &image)
+{
+  const QString e = QString("%1@%2x%3")
+      .arg(elementId)
+      .arg(size.width())
+      .arg(size.height());
+  const QString k = QString("%1/%2").arg(sk).arg(e);
+
+  // the file was loaded again meanwhile
+  if ( g != generation.loadAcquire() )
+    return;
+
+  const pending_t pending = pendingMisses.take(k);
+
+  // rendered synchronously meanwhile, keep its usage counts
+  if ( svgCache[sk].contains(e) ) {
+    updatePending(pending);
+    return;
+  }
+
+  svgCacheEntry entry;
+  entry.hits = entry.svgRenderTime = entry.cachedRenderTime = 0;
+  entry.lastUse = clock.elapsed();
+  // warm-up renderings are only counted as used once hit
+  entry.prewarmed = !pending.drawn;
+  bool opaque;
+  const QByteArray hash = rasterHash(image,&opaque);
+  if ( !shareRaster(entry,hash) ) {
+    entry.pixmap = QPixmap::fromImage(image);
+    entry.mask = entry.pixmap.mask();
+    if ( image.devicePixelRatio() != 1.0 )
+      entry.mask = QTransform::fromScale(1.0/image.devicePixelRatio(),
+                                         1.0/image.devicePixelRatio()).map(entry.mask);
+    addRaster(entry,hash);
+  }
+
+  if ( !opaque || !opacity.contains(elementId) )
+    opacity.insert(elementId, opaque);
+
+  svgCache[sk].insert(e,entry);
+
+  updatePending(pending);
+}
+
+void QSvgCachedRenderer::updatePending(const pending_t &pending)
+{
+  for (int i=0; i<pending.widgets.size(); i++) {
+    QWidget *w = pending.widgets.at(i);
+    if ( !w )
+      continue;
+    if ( pending.rects.at(i).isNull() )
+      w->update();
+    else
+      w->update(pending.rects.at(i));
+  }
+}
+
+QRegion QSvgCachedRenderer::alphaRegion(const QImage &image)
+{
+  // QBitmap can not be used outside of the GUI thread: collect runs
+  // of opaque enough pixels, line by line
+  const QImage img = image.convertToFormat(QImage::Format_ARGB32);
+  QVector<QRect> rects;
+
+  for (int y=0; y<img.height(); y++) {
+    const QRgb *line = reinterpret_cast<const QRgb *>(img.constScanLine(y));
+    int x = 0;
+    while ( x < img.width() ) {
+      while ( (x < img.width()) && (qAlpha(line[x]) < 128) )
+        x++;
+      const int x0 = x;
+      while ( (x < img.width()) && (qAlpha(line[x]) >= 128) )
+        x++;
+      if ( x > x0 )
+        rects << QRect(x0,y,x-x0,1);
+    }
+  }
+
+  QRegion region;
+  region.setRects(rects.constData(),rects.size());
+
+  const qreal scale = image.devicePixelRatio();
+  if ( scale != 1.0 )
+    region = QTransform::fromScale(1.0/scale,1.0/scale).map(region);
+
+  return region;
+}
+
+bool QSvgCachedRenderer::isVectorDevice(const QPainter *painter)
+{
+  const QPaintEngine *e = painter->paintEngine();
+  if ( !e )
+    return false;
+
+  switch ( e->type() ) {
+    case QPaintEngine::Pdf:
+    case QPaintEngine::SVG:
+    case QPaintEngine::Picture:
+    case QPaintEngine::MacPrinter:
+    case QPaintEngine::Windows:
+      return true;
+    default:
+      return false;
+  }
+}
+
+bool QSvgCachedRenderer::isElementOpaque(const QString &elementId)
+{
+  if ( !renderer || !renderer->elementExists(elementId) )
+    return false;
+
+  QHash<QString,bool>::const_iterator it = opacity.constFind(elementId);
+  if ( it != opacity.constEnd() )
+    return it.value();
+
+  // not rendered yet: probe it at its natural size
+  QSize sz = renderer->boundsOnElement(elementId).toAlignedRect().size();
+  sz = sz.boundedTo(QSize(64,64)).expandedTo(QSize(1,1));
+
+  QImage probe(sz, QImage::Format_ARGB32_Premultiplied);
+  probe.fill(Qt::transparent);
+  QPainter p(&probe);
+  renderer->render(&p,elementId,QRect(QPoint(0,0),sz));
+  p.end();
+
+  const bool opaque = isOpaque(probe);
+  opacity.insert(elementId, opaque);
+
+  return opaque;
+}
+
+bool QSvgCachedRenderer::isOpaque(const QImage &image)
+{
+  if ( image.isNull() )
+    return false;
+
+  if ( !image.hasAlphaChannel() )
+    return true;
+
+  const QImage img = image.convertToFormat(QImage::Format_ARGB32);
+  for (int y=0; y<img.height(); y++) {
+    const QRgb *line = reinterpret_cast<const QRgb *>(img.constScanLine(y));
+    for (int x=0; x<img.width(); x++) {
+      if ( qAlpha(line[x]) != 255 )
+        return false;
+    }
+  }
+
+  return true;
+}
+
+qreal QSvgCachedRenderer::renderScale(const QPainter *painter)
+{
+  // vector devices get vector output
+  if ( isVectorDevice(painter) )
+    return 0;
+
+  const qreal dpr = painter->device() ? painter->device()->devicePixelRatioF() : 1.0;
+  const QTransform t = painter->worldTransform();
+
+  if ( t.isProjective() )
+    return 0;
+
+  // Only axis aligned transforms can reuse renderings: scales, flips
+  // and the transpositions used for vertical elements
+  qreal s;
+  if ( qFuzzyIsNull(t.m12()) && qFuzzyIsNull(t.m21()) )
+    s = qMax(qAbs(t.m11()),qAbs(t.m22()));
+  else if ( qFuzzyIsNull(t.m11()) && qFuzzyIsNull(t.m22()) )
+    s = qMax(qAbs(t.m12()),qAbs(t.m21()));
+  else
+    return 0;
+
+  if ( qFuzzyCompare(s,1.0) )
+    return dpr;
+
+  // quantize to 1/4 steps so that zooming does not fill the cache
+  return dpr*qBound(0.25,qCeil(s*4)/4.0,8.0);
+}
+
 void QSvgCachedRenderer::dumpStats()
 {
   qWarning() << "[QSvgCacheRenderer] Stats:";
@@ -162,4 +1270,8 @@ void QSvgCachedRenderer::dumpStats()
   qWarning() << "Cache render time:" << totalCachedRenderTime
              << "SVG render time:" << totalSvgRenderTime
              << "Cache speedup:" << totalSvgRenderTime*1.0/totalCachedRenderTime;
+  quint64 used, saved;
+  memoryStats(used,saved);
+  qWarning() << "Cache memory:" << used/1024 << "KB"
+             << "Saved by sharing identical renderings:" << saved/1024 << "KB";
 }
@@ -25,13 +25,30 @@
 #include <QPixmap>
 #include <QBitmap>
 #include <QSvgRenderer>
+#include <QStringList>
+#include <QList>
+#include <QSet>
+#include <QImage>
+#include <QMutex>
+#include <QAtomicInt>
+#include <QPointer>
+#include <QElapsedTimer>
 
 class QPainter;
 class QRectF;
 class QString;
+class QWidget;
+class QObject;
+class QThreadPool;
+class QTimer;
 
 /**
  * @brief Wrapper around QSvgRenderer class with rendering caching capabilities
+ *
+ * Rendering is also possible from worker threads, e.g. to render styled
+ * widgets into a QImage. Worker threads use their own QSvgRenderer and
+ * share a QImage cache split into independently locked shards. The file
+ * must not be (re)loaded while worker threads render.
  */
 class QSvgCachedRenderer
 {
@@ -41,10 +58,90 @@ class QSvgCachedRenderer
     virtual ~QSvgCachedRenderer();
 
     /**
-     * Loads the given SVG file
+     * Loads the given SVG file. The file can be a compressed SVG file (svgz)
+     * or a theme package, in which case the SVG file it contains is loaded
      */
     bool load(const QString &file);
 
+    /**
+     * Returns the loaded file
+     */
+    QString filename() const { return file; }
+
+    /**
+     * Enables or disables change tracking. When enabled, a hash of the
+     * XML fragment of each element is kept so that @ref reload can tell
+     * which elements changed
+     */
+    void setTrackChanges(bool enabled);
+
+    /**
+     * Loads the file again and only discards the cached renderings of
+     * the elements that changed since the last load. An element has
+     * changed if its XML fragment or the fragment of an element it
+     * references (gradients, patterns, clones) changed.
+     * Returns the ids of the changed elements. If change tracking is
+     * disabled, the whole cache is discarded and an empty list is returned
+     */
+    QStringList reload();
+
+    /**
+      * Enables or disables asynchronous cache misses. When enabled, a miss
+      * draws the nearest size cached rendering of the element scaled, and
+      * the exact rendering is made by a worker thread. The widget set by
+      * @ref setPaintTarget is then repainted. Elements never rendered at
+      * any size, or painted without a target, are still rendered right away
+      */
+    void setAsyncMisses(bool enabled) { asyncMisses = enabled; }
+
+    /**
+      * Sets the widget being painted, repainted when the renderings
+      * it is waiting for are ready. While a widget is interactively
+      * resized, its elements missing from the cache are stretched from
+      * their nearest cached size and only rendered exactly once the
+      * resize settles, so the transient sizes do not fill the cache.
+      * The target must be reset when its painting ends: without a
+      * target, misses are rendered right away
+      */
+    void setPaintTarget(const QWidget *widget) { paintTarget = widget; }
+    const QWidget *currentPaintTarget() const { return paintTarget; }
+
+    /**
+      * Sets the number of minutes after which unused renderings are
+      * compressed in memory. They are uncompressed on their next use.
+      * 0 keeps all the renderings uncompressed
+      */
+    void setColdDelay(int minutes);
+
+    /**
+      * Returns the number of placeholders drawn so far. Callers caching
+      * what they paint must not cache it if this changed meanwhile
+      */
+    quint32 placeholderCount() const { return placeholders; }
+
+    /**
+      * Writes the elements drawn so far, with their sizes, scales and use
+      * counts to the given usage profile file. Counts already in the file
+      * are halved and merged, so that the profile follows recent usage.
+      * Only the @p max most used entries are kept
+      */
+    void saveUsageProfile(const QString &profile, int max = 512) const;
+
+    /**
+      * Renders in the background the entries of the given usage profile,
+      * most used first. Profiles recorded with another SVG file are
+      * ignored
+      */
+    void warmUp(const QString &profile);
+
+    /**
+      * Returns the memory used by the cached renderings in @p used, and
+      * the memory saved by sharing identical renderings between elements
+      * in @p saved, in bytes. Compressed renderings count for their
+      * compressed size
+      */
+    void memoryStats(quint64 &used, quint64 &saved) const;
+
     /**
       * Returns if the loaded file is valid
       */
@@ -58,17 +155,46 @@ class QSvgCachedRenderer
     /**
       * Returns whether the given element id exists in SVG file and is renderable
       */
-    bool elementExists(const QString &id) const {
-      return renderer ? renderer->elementExists(id) : false;
-    }
+    bool elementExists(const QString &id) const;
 
     /**
       * Returns the computed clip region for the given element translated
       * to the given bounds. The element must have
-      * been rendered at least once, otherwise a full region will be
-      * returned
+      * been rendered at least once at the given scale (see @ref renderScale),
+      * otherwise a full region will be returned
+      */
+    QRegion elementRegion(const QString &elementId, const QRect &bounds,
+                          qreal scale = 1.0);
+
+    /**
+      * Drops the cached renderings made for scales other than the given
+      * device pixel ratios, e.g. when a screen goes away
+      */
+    void retainScales(const QList<qreal> &dprs);
+
+    /**
+      * Returns the scale at which elements painted with the given painter
+      * are rasterized: the device pixel ratio times the world transform
+      * scale, quantized. Returns 0 when the world transform rotates or
+      * shears, or for vector devices, in which case elements are rendered
+      * directly
+      */
+    static qreal renderScale(const QPainter *painter);
+
+    /**
+      * Returns whether the given painter paints on a vector device (PDF,
+      * printer, SVG, picture). Elements are not rasterized for such
+      * devices but rendered as vectors
+      */
+    static bool isVectorDevice(const QPainter *painter);
+
+    /**
+      * Returns whether the given element covers all of its bounds with
+      * fully opaque pixels. The alpha channel of each element is analyzed
+      * once, when it is first cached. Elements not rendered yet are
+      * rendered once at their natural size to find out
       */
-    QRegion elementRegion(const QString &elementId, const QRect &bounds);
+    bool isElementOpaque(const QString &elementId);
 
   private:
     typedef struct svgCacheEntry {
@@ -76,17 +202,189 @@ class QSvgCachedRenderer
         qreal svgRenderTime;
         quint64 cachedRenderTime;
 
+        // rendered by the warm-up, not drawn yet
+        bool prewarmed;
+        // time of the last use, see clock
+        qint64 lastUse;
+
         QPixmap pixmap;
         QRegion mask;
+
+        // compressed pixels of cold entries, whose pixmap is then null
+        QByteArray packed;
+        QSize packedSize;
+        qreal packedDpr;
+        QImage::Format packedFormat;
     } svgCacheEntry;
 
     void dumpStats();
 
+    /* Returns whether the caller runs in the GUI thread, the only
+     * one allowed to use pixmaps */
+    static bool isGuiThread();
+
+    typedef QHash<QString,svgCacheEntry> partition_t;
+
+    typedef struct {
+        QList<QPointer<QWidget> > widgets;
+        // in widget coordinates, null to repaint the whole widget
+        QList<QRect> rects;
+        // a placeholder was drawn, as opposed to a warm-up rendering
+        bool drawn = false;
+    } pending_t;
+
+    /* Returns the renderer of the calling worker thread, loading it if
+     * needed */
+    QSvgRenderer *threadRenderer() const;
+    static QSvgRenderer *threadRenderer(const void *owner, const QString &file,
+                                        int generation);
+
+    /* Returns the cached rendering of the given element whose size is
+     * the nearest to the given one, NULL if there is none */
+    const svgCacheEntry *nearestEntry(const partition_t &partition,
+                                      const QString &elementId,
+                                      const QSize &size) const;
+
+    /* Registers the current paint target to be repainted once the
+     * given element is ready */
+    void addPaintTarget(pending_t &pending, QPainter *painter, const QRect &bounds) const;
+
+    /* Returns whether the given element is missed at successive sizes,
+     * as during interactive resizes */
+    bool isResizeStorm(const QString &elementId);
+
+    /* Stretches the nearest rendering of the given element, or renders
+     * it uncached, until the resize storm settles */
+    void renderStretched(QPainter *painter, const QString &elementId,
+                         const QRect &bounds, qreal scale);
+
+    /* Repaints the widgets that received stretched renderings */
+    void resizeSettled();
+
+    /* Draws a placeholder for the given missed element and queues its
+     * rendering. Returns false if there is no placeholder to draw */
+    bool renderAsync(QPainter *painter, const QString &elementId,
+                     const QRect &bounds, qreal scale);
+
+    /* Queues the rendering of the given element by a worker thread */
+    void queueRendering(const QString &elementId, const QSize &size, qreal scale);
+
+    /* Repaints the widgets waiting for a rendering */
+    static void updatePending(const pending_t &pending);
+
+    /* Stores a rendering made by a worker thread */
+    void asyncRenderDone(const QString &elementId, const QSize &size,
+                         int scaleKey, int generation, const QImage &image);
+
+    /* Renders from a worker thread, caching images instead of pixmaps */
+    void renderThreaded(QPainter *painter, const QString &elementId, const QRect &bounds);
+
+    /* Returns the hash of the pixels of the given rendering. If opaque
+     * is given, it is set to whether all the pixels are opaque, computed
+     * in the same pass */
+    static QByteArray rasterHash(const QImage &image, bool *opaque = NULL);
+
+    /* Makes the given entry share an identical rendering already cached
+     * under another key, returns false if there is none */
+    bool shareRaster(svgCacheEntry &entry, const QByteArray &hash);
+
+    /* Makes the rendering of the given entry available for sharing */
+    void addRaster(const svgCacheEntry &entry, const QByteArray &hash);
+
+    /* Forgets the renderings no entry uses anymore */
+    void purgeRasters();
+
+    /* Compresses the renderings not used for coldDelay minutes */
+    void compressColdEntries();
+
+    /* Uncompresses the rendering of the given cold entry */
+    void uncompressEntry(svgCacheEntry &entry);
+
+    /* Returns the region covered by the opaque enough pixels of the
+     * given image, in logical coordinates */
+    static QRegion alphaRegion(const QImage &image);
+
+    /* Returns whether all the pixels of the given image are opaque */
+    static bool isOpaque(const QImage &image);
+
+    /* Computes the hash of the XML fragment of each element having an id,
+     * along with the ids each element references */
+    static void hashFragments(const QByteArray &xml,
+                              QHash<QString,QByteArray> &hashes,
+                              QHash<QString,QStringList> &refs);
+
     // the SVG renderer
     QSvgRenderer *renderer;
 
-    // the in-memory SVG cache
-    QHash<QString,svgCacheEntry> svgCache;
+    /* Returns the cache partition key of the given scale */
+    static int scaleKey(qreal scale) { return qRound(scale*100); }
+
+    // the in-memory SVG cache, one partition per scale
+    QHash<int,partition_t> svgCache;
+
+    // distinct renderings, shared by the entries having the same
+    // pixels, key = hash of the pixels
+    typedef struct {
+        QPixmap pixmap;
+        QRegion mask;
+    } raster_t;
+
+    QHash<QByteArray,raster_t> rasters;
+
+    // cold entries compression
+    int coldDelay;
+    QTimer *coldTimer;
+    QElapsedTimer clock;
+
+    // opacity of elements, by id
+    QHash<QString,bool> opacity;
+
+    // the image cache used by worker threads, key = id@WxH@scale
+    typedef struct {
+        QImage image;
+        QRegion mask;
+    } imageCacheEntry;
+
+    enum { IMAGE_CACHE_SHARDS = 16 };
+    struct {
+        QMutex mutex;
+        QHash<QString,imageCacheEntry> entries;
+    } imageCache[IMAGE_CACHE_SHARDS];
+
+    // incremented at each load, thread renderers of older loads are
+    // discarded
+    QAtomicInt generation;
+
+    // asynchronous cache misses
+    bool asyncMisses;
+    QThreadPool *asyncPool;
+    // context of the deliveries of worker renderings
+    QObject *asyncContext;
+    const QWidget *paintTarget;
+    quint32 placeholders;
+
+    // pending renderings, key = scale / elementId@WxH
+    QHash<QString,pending_t> pendingMisses;
+
+    // resize storms: successive misses of an element at new sizes while
+    // its widget is resized, key = elementId@widget
+    typedef struct {
+        QElapsedTimer lastMiss;
+        // size of the widget
+        QSize lastSize;
+    } miss_t;
+
+    QHash<QString,miss_t> recentMisses;
+    // elements being stretched, key = elementId@widget
+    QSet<QString> storming;
+    // widgets to repaint once the storm settles
+    pending_t stormTargets;
+    QTimer *settleTimer;
+
+    // change tracking
+    QString file;
+    bool trackChanges;
+    QHash<QString,QByteArray> fragmentHashes;
 
     quint32 totalCacheHits, totalCacheMisses;
     quint64 totalSvgRenderTime, totalCachedRenderTime;
@@ -21,6 +21,7 @@
 #include <QPainterPath>
 
 #include <QApplication>
+#include <QPaintEngine>
 #include <QWidget>
 #include <QPainter>
 #include <QPainterPath>
@@ -43,12 +44,19 @@
 #include <QStyleHints>
 #include <QMetaObject>
 #include <QMetaEnum>
+#include <QFileSystemWatcher>
+#include <QFileInfo>
+#include <QPointer>
 
 #include <QSpinBox>
+#include <QPaintEvent>
+#include <QScreen>
+#include <QThread>
 #include <QToolButton>
 #include <QToolBar>
 #include <QPushButton>
 #include <QComboBox>
+#include <QAbstractItemView>
 #include <QLineEdit>
 #include <QProgressBar>
 #include <QMenu>
@@ -64,8 +72,10 @@
 #include <QHeaderView>
 
 #include "QSvgCachedRenderer.h"
+#include "QSvgAnimationScheduler.h"
 #include "ThemeConfig.h"
 #include "StyleConfig.h"
+#include "ThemePackage.h"
 #include "groups.h"
 
 QSvgThemableStyle::QSvgThemableStyle()
@@ -76,18 +86,71 @@ QSvgThemableStyle::QSvgThemableStyle()
     styleSettings(nullptr),
     useConfigCache(true),
     useShapeCache(true),
-    progresstimer(nullptr),
+    useCompositeCache(true),
+    drawDepth(0),
+    quality(QualityHigh),
+    dialAngleStep(1),
+    asyncMisses(false),
+    usageProfile(true),
+    coldDelay(5),
+    transitionsEnabled(true),
+    transitionDuration(150),
+    transitionStep(16),
+    compositeDepth(0),
+    prewarmTimer(nullptr),
+    windowPainted(false),
+    hotReload(false),
+    trackChanges(false),
+    hotReloadWatcher(nullptr),
+    hotReloadTimer(nullptr),
+    animations(nullptr),
+    countPaintArea(false),
+    paintArea(0),
     dbgWireframe(false),
     dbgOverdraw(false)
 {
   loadUserConfig();
 
-  progresstimer = new QTimer(this);
-  connect(progresstimer,SIGNAL(timeout()), this,SLOT(slot_animateProgressBars()));
+  animations = new QSvgAnimationScheduler(this);
+
+  setupEngineTweaks();
+
+  // Caches are partitioned by device pixel ratio, one per screen scale
+  if ( qApp )
+    connect(qApp,&QGuiApplication::screenRemoved,
+            this,&QSvgThemableStyle::slot_screenRemoved);
+
+  // Theme development: reload theme files as they are edited
+  if ( qEnvironmentVariableIntValue("QSVGSTYLE_HOTRELOAD") )
+    setHotReload(true);
+
+  // Performance measurement: count repainted pixels
+  if ( qEnvironmentVariableIntValue("QSVGSTYLE_PAINTSTATS") )
+    setCountPaintedArea(true);
+
+  // Pre-render what this application drew last time, before its first
+  // window is shown. Themes being edited change too often for this
+  if ( usageProfile && !trackChanges && themeRndr &&
+       !StyleConfig::getUsageProfileFile().isEmpty() )
+    themeRndr->warmUp(StyleConfig::getUsageProfileFile());
 }
 
 QSvgThemableStyle::~QSvgThemableStyle()
 {
+  if ( qEnvironmentVariableIntValue("QSVGSTYLE_PAINTSTATS") ) {
+    qWarning() << "[QSvgStyle]" << "Painted area:" << paintArea << "pixels";
+    if ( themeRndr ) {
+      quint64 used, saved;
+      themeRndr->memoryStats(used,saved);
+      qWarning() << "[QSvgStyle]" << "Element cache:" << used/1024 << "KB,"
+                 << saved/1024 << "KB saved by sharing identical renderings";
+    }
+  }
+
+  if ( usageProfile && !trackChanges && themeRndr &&
+       !StyleConfig::getUsageProfileFile().isEmpty() )
+    themeRndr->saveUsageProfile(StyleConfig::getUsageProfileFile());
+
   delete themeSettings;
   delete themeRndr;
 }
@@ -131,6 +194,8 @@ void QSvgThemableStyle::loadCustomStyleConfig(const QString& filename)
 
   qDebug() << "[QSvgStyle]" << "Loaded custom config file" << filename;
 
+  setupEngineTweaks();
+
   loadTheme(styleSettings->getStyleSpec().theme);
 }
 
@@ -147,9 +212,13 @@ void QSvgThemableStyle::loadBuiltinTheme()
 
   themeSettings = new ThemeConfig(":/default.cfg");
   themeRndr = new QSvgCachedRenderer();
+  themeRndr->setAsyncMisses(asyncMisses);
+  themeRndr->setColdDelay(coldDelay);
   themeRndr->load(QString(":/default.svg"));
 
   curTheme = "<builtin>";
+  invalidateCaches();
+  updateHotReloadWatcher();
   qWarning() << "[QSvgStyle]" << "Loaded built in theme";
 }
 
@@ -176,11 +245,14 @@ void QSvgThemableStyle::loadTheme(const QString& theme)
       themeRndr = nullptr;
 
       themeRndr = new QSvgCachedRenderer();
-      themeRndr->load(
-        QFileInfo(t.path).absolutePath().append("/").append(
-        QFileInfo(t.path).completeBaseName().append(".svg")));
+      themeRndr->setAsyncMisses(asyncMisses);
+      themeRndr->setColdDelay(coldDelay);
+      themeRndr->setTrackChanges(trackChanges);
+      themeRndr->load(ThemePackage::svgFile(t.path));
 
       curTheme = theme;
+      invalidateCaches();
+      updateHotReloadWatcher();
       qWarning() << "[QSvgStyle]" << "Loaded theme " << theme;
 
       return;
@@ -213,9 +285,19 @@ void QSvgThemableStyle::loadCustomSVG(const QString& filename)
   delete themeRndr;
   themeRndr = nullptr;
 
+  // custom files are being edited, track their changes so that
+  // reloadChangedFiles() only invalidates what changed
+  trackChanges = true;
+
   themeRndr = new QSvgCachedRenderer();
+  themeRndr->setAsyncMisses(asyncMisses);
+  themeRndr->setColdDelay(coldDelay);
+  themeRndr->setTrackChanges(true);
   themeRndr->load(filename);
 
+  invalidateCaches();
+  updateHotReloadWatcher();
+
   qDebug() << "[QSvgStyle] loaded custom SVG file" << filename;
 }
 
@@ -231,12 +313,17 @@ void QSvgThemableStyle::loadCustomThemeConfig(const QString& filename)
   themeSettings->setUseCache(useConfigCache);
 
   curTheme = QString("custom:%1").arg(filename);
+  trackChanges = true;
+  invalidateCaches();
+  updateHotReloadWatcher();
+
   qDebug() << "[QSvgStyle] loaded custom theme file" << filename;
 }
 
 void QSvgThemableStyle::setUseConfigCache(bool val)
 {
   useConfigCache = val;
+  invalidateCaches();
 
   if ( themeSettings )
     themeSettings->setUseCache(val);
@@ -247,7 +334,320 @@ void QSvgThemableStyle::setUseConfigCache(bool val)
 void QSvgThemableStyle::setUseShapeCache(bool val)
 {
   useShapeCache = val;
-  // TODO
+  invalidateCaches();
+}
+
+void QSvgThemableStyle::setUseCompositeCache(bool val)
+{
+  useCompositeCache = val;
+  compositeCache.clear();
+  compositeDeps.clear();
+}
+
+void QSvgThemableStyle::invalidateCaches()
+{
+  compositeCache.clear();
+  compositeDeps.clear();
+  specCache.clear();
+  opacityCache.clear();
+  prewarmed.clear();
+}
+
+void QSvgThemableStyle::invalidateCaches(const QStringList &groups,
+                                         const QStringList &elements)
+{
+  QHash<QString,bool> affected;
+  auto isAffected = [&](const QString &g) {
+    if ( !affected.contains(g) )
+      affected.insert(g, isGroupAffected(g, groups, elements));
+    return affected.value(g);
+  };
+
+  // composites: only those built from what changed. Composites whose
+  // sources are unknown are dropped
+  Q_FOREACH(const QString &k, compositeCache.keys()) {
+    QHash<QString,composite_deps_t>::const_iterator it = compositeDeps.constFind(k);
+    bool drop = (it == compositeDeps.constEnd());
+    if ( !drop ) {
+      Q_FOREACH(const QString &e, elements) {
+        if ( it.value().elements.contains(e) ) {
+          drop = true;
+          break;
+        }
+      }
+    }
+    if ( !drop ) {
+      Q_FOREACH(const QString &g, it.value().groups) {
+        if ( isAffected(g) ) {
+          drop = true;
+          break;
+        }
+      }
+    }
+    if ( drop )
+      compositeCache.remove(k);
+  }
+
+  // forget the sources of composites gone from the cache
+  QHash<QString,composite_deps_t>::iterator it = compositeDeps.begin();
+  while ( it != compositeDeps.end() ) {
+    if ( !compositeCache.contains(it.key()) )
+      it = compositeDeps.erase(it);
+    else
+      ++it;
+  }
+
+  // specs only depend on the config, and on inherited groups
+  Q_FOREACH(const QString &g, specCache.keys()) {
+    if ( isGroupAffected(g, groups, QStringList()) )
+      specCache.remove(g);
+  }
+
+  // key = group/states
+  Q_FOREACH(const QString &k, opacityCache.keys()) {
+    if ( isAffected(k.section('/',0,0)) )
+      opacityCache.remove(k);
+  }
+
+  prewarmed.clear();
+}
+
+void QSvgThemableStyle::slot_transitionWidgetDestroyed(QObject *o)
+{
+  // only the address is used, the widget is already gone
+  transitions.remove(static_cast<const QWidget *>(o));
+}
+
+void QSvgThemableStyle::slot_screenRemoved(QScreen *screen)
+{
+  QList<qreal> dprs;
+  Q_FOREACH(const QScreen *s, QGuiApplication::screens()) {
+    if ( (s != screen) && !dprs.contains(s->devicePixelRatio()) )
+      dprs << s->devicePixelRatio();
+  }
+
+  if ( themeRndr )
+    themeRndr->retainScales(dprs);
+
+  // composite keys end with @dpr
+  Q_FOREACH(const QString &k, compositeCache.keys()) {
+    if ( !dprs.contains(k.section('@',-1).toDouble()) )
+      compositeCache.remove(k);
+  }
+}
+
+void QSvgThemableStyle::setupEngineTweaks()
+{
+  QVariant v;
+
+  // composite cache size in KB
+  v = styleSettings ? getStyleTweak("engine.composite.cachesize") : QVariant();
+  compositeCache.setMaxCost(qMax(0, v.isValid() ? v.toInt() : 16384));
+
+  // dial handle angle step in degrees
+  v = styleSettings ? getStyleTweak("engine.dial.anglestep") : QVariant();
+  dialAngleStep = qBound(0, v.isValid() ? v.toInt() : 1, 90);
+
+  // usage profile recording and cache warm-up
+  v = styleSettings ? getStyleTweak("engine.profile.disable") : QVariant();
+  usageProfile = !v.toBool();
+
+  // asynchronous cache misses
+  v = styleSettings ? getStyleTweak("engine.async") : QVariant();
+  asyncMisses = v.toBool();
+  if ( themeRndr )
+    themeRndr->setAsyncMisses(asyncMisses);
+
+  // compression of unused element renderings, in minutes
+  v = styleSettings ? getStyleTweak("engine.cache.colddelay") : QVariant();
+  coldDelay = qMax(0, v.isValid() ? v.toInt() : 5);
+  if ( themeRndr )
+    themeRndr->setColdDelay(coldDelay);
+
+  // state transitions
+  v = styleSettings ? getStyleTweak("engine.transitions.disable") : QVariant();
+  transitionsEnabled = !v.toBool();
+
+  v = styleSettings ? getStyleTweak("engine.transitions.duration") : QVariant();
+  transitionDuration = qMax(0, v.isValid() ? v.toInt() : 150);
+  if ( transitionDuration == 0 )
+    transitionsEnabled = false;
+
+  v = styleSettings ? getStyleTweak("engine.transitions.maxfps") : QVariant();
+  transitionStep = 1000/qBound(1, v.isValid() ? v.toInt() : 60, 1000);
+
+  // rendering quality profile, the environment takes precedence
+  QString q = qEnvironmentVariable("QSVGSTYLE_QUALITY");
+  if ( q.isEmpty() && styleSettings )
+    q = getStyleTweak("engine.quality").toString();
+  q = q.trimmed().toLower();
+
+  const Quality old = quality;
+  quality = (q == "fast") ? QualityFast :
+            (q == "balanced") ? QualityBalanced : QualityHigh;
+
+  if ( quality == QualityBalanced )
+    transitionStep = qMax(transitionStep, 1000/30);
+  if ( quality == QualityFast )
+    transitionsEnabled = false;
+
+  // composites were rendered with the previous profile
+  if ( quality != old )
+    invalidateCaches();
+}
+
+void QSvgThemableStyle::setHotReload(bool val)
+{
+  if ( hotReload == val )
+    return;
+
+  hotReload = val;
+
+  if ( hotReload ) {
+    trackChanges = true;
+    if ( themeRndr )
+      themeRndr->setTrackChanges(true);
+
+    if ( !hotReloadWatcher ) {
+      hotReloadWatcher = new QFileSystemWatcher(this);
+      connect(hotReloadWatcher,SIGNAL(fileChanged(QString)),
+              this,SLOT(slot_hotReloadFileChanged(QString)));
+
+      // editors save files in several steps, wait for them to settle
+      hotReloadTimer = new QTimer(this);
+      hotReloadTimer->setSingleShot(true);
+      connect(hotReloadTimer,&QTimer::timeout,
+              this,&QSvgThemableStyle::reloadChangedFiles);
+    }
+
+    qWarning() << "[QSvgStyle]" << "Hot reload of theme files enabled";
+  }
+
+  updateHotReloadWatcher();
+}
+
+void QSvgThemableStyle::updateHotReloadWatcher()
+{
+  if ( !hotReloadWatcher )
+    return;
+
+  if ( !hotReloadWatcher->files().isEmpty() )
+    hotReloadWatcher->removePaths(hotReloadWatcher->files());
+
+  if ( !hotReload )
+    return;
+
+  QStringList files;
+  if ( themeSettings )
+    files << themeSettings->filename();
+  if ( themeRndr )
+    files << themeRndr->filename();
+
+  // built in theme does not change
+  Q_FOREACH(const QString &f, files) {
+    if ( !f.isEmpty() && !f.startsWith(":") && !hotReloadWatcher->files().contains(f) )
+      hotReloadWatcher->addPath(f);
+  }
+}
+
+void QSvgThemableStyle::slot_hotReloadFileChanged(const QString &filename)
+{
+  // files replaced by editors (write then rename) are no longer watched
+  if ( QFile::exists(filename) && !hotReloadWatcher->files().contains(filename) )
+    hotReloadWatcher->addPath(filename);
+
+  hotReloadTimer->start(300);
+}
+
+void QSvgThemableStyle::reloadChangedFiles()
+{
+  QStringList groups, elements;
+
+  if ( themeSettings )
+    groups = themeSettings->reload();
+  if ( themeRndr )
+    elements = themeRndr->reload();
+
+  if ( groups.isEmpty() && elements.isEmpty() )
+    return;
+
+  qWarning() << "[QSvgStyle]" << "Reloaded" << groups.count() << "groups and"
+             << elements.count() << "SVG elements";
+
+  // tweaks apply to all widgets
+  const bool all = groups.contains("Tweaks") || groups.contains("General");
+
+  if ( all )
+    invalidateCaches();
+  else
+    invalidateCaches(groups, elements);
+
+  // repaint only the widgets rendered with the affected groups.
+  // Pointers of destroyed widgets are never dereferenced: only live
+  // widgets are looked up
+  QHash<const QWidget *, QSet<QString> > users;
+  QHash<QString,bool> affected;
+
+  Q_FOREACH(QWidget *w, QApplication::allWidgets()) {
+    QHash<const QWidget *, QSet<QString> >::const_iterator it =
+      changeTrackedUsers.constFind(w);
+    if ( it == changeTrackedUsers.constEnd() )
+      continue;
+
+    users.insert(w, it.value());
+
+    bool repaint = all;
+    Q_FOREACH(const QString &g, it.value()) {
+      if ( repaint )
+        break;
+      if ( !affected.contains(g) )
+        affected.insert(g, isGroupAffected(g, groups, elements));
+      repaint = affected.value(g);
+    }
+
+    if ( repaint ) {
+      w->updateGeometry();
+      w->update();
+    }
+  }
+
+  changeTrackedUsers = users;
+}
+
+bool QSvgThemableStyle::isGroupAffected(const QString &group,
+                                        const QStringList &groups,
+                                        const QStringList &elements) const
+{
+  if ( !themeSettings )
+    return true;
+
+  // the group itself or one of the groups it inherits changed
+  QString g = group;
+  for (int depth=0; !g.isEmpty() && (depth <= 3); depth++) {
+    if ( groups.contains(g) )
+      return true;
+    g = themeSettings->getRawValue(g,"element.inherits").toString();
+  }
+
+  if ( elements.isEmpty() )
+    return false;
+
+  // one of the SVG elements of the group changed
+  const QStringList basenames = QStringList()
+    << getFrameSpec(group).element
+    << getInteriorSpec(group).element
+    << getIndicatorSpec(group).element;
+
+  Q_FOREACH(const QString &b, basenames) {
+    if ( b.isEmpty() )
+      continue;
+    Q_FOREACH(const QString &e, elements) {
+      if ( (e == b) || e.startsWith(b+"-") )
+        return true;
+    }
+  }
+
+  return false;
 }
 
 bool QSvgThemableStyle::isContainerWidget(const QWidget * widget) const
@@ -287,6 +687,102 @@ bool QSvgThemableStyle::isAnimatableWidget(const QWidget * widget) const
   );
 }
 
+bool QSvgThemableStyle::isSubControlHoverWidget(const QWidget * widget) const
+{
+  return widget && (
+    widget->inherits("QScrollBar") ||
+    widget->inherits("QAbstractSpinBox")
+  );
+}
+
+bool QSvgThemableStyle::hoverUpdateRegion(const QWidget * widget,
+                                          QRegion &region) const
+{
+  region = QRegion();
+
+  // the groove is never hovered, only the slider and buttons are
+  if ( qobject_cast< const QScrollBar * >(widget) )
+    return true;
+
+  // the frame follows the widget hover state, but not the edit field
+  if ( qobject_cast< const QAbstractSpinBox * >(widget) ) {
+    const QLineEdit *l =
+      widget->findChild<QLineEdit *>(QString(), Qt::FindDirectChildrenOnly);
+    if ( !l || !l->isVisible() )
+      return false;
+
+    region = QRegion(widget->rect()) - l->geometry();
+    return true;
+  }
+
+  return false;
+}
+
+void QSvgThemableStyle::setCountPaintedArea(bool val)
+{
+  if ( val == countPaintArea )
+    return;
+
+  countPaintArea = val;
+  paintArea = 0;
+
+  if ( countPaintArea ) {
+    Q_FOREACH(QWidget *w, QApplication::allWidgets()) {
+      w->installEventFilter(this);
+    }
+  }
+}
+
+bool QSvgThemableStyle::isGroupOpaque(const QString &group,
+                                      const QStringList &states) const
+{
+  if ( !themeRndr || group.isEmpty() || dbgWireframe || dbgOverdraw )
+    return false;
+
+  const QString key = group+"/"+states.join(",");
+  QHash<QString,bool>::const_iterator it = opacityCache.constFind(key);
+  if ( it != opacityCache.constEnd() )
+    return it.value();
+
+  const frame_spec_t fs = getFrameSpec(group);
+  const interior_spec_t is = getInteriorSpec(group);
+
+  // the interior fills what the frame does not
+  bool opaque = is.hasInterior;
+
+  Q_FOREACH(const QString &st, states) {
+    if ( !opaque )
+      break;
+
+    opaque = themeRndr->isElementOpaque(is.element+"-"+st);
+
+    if ( fs.hasFrame ) {
+      const QString e = fs.element+"-"+st;
+      if ( fs.top > 0 )
+        opaque = opaque && themeRndr->isElementOpaque(e+"-top");
+      if ( fs.bottom > 0 )
+        opaque = opaque && themeRndr->isElementOpaque(e+"-bottom");
+      if ( fs.left > 0 )
+        opaque = opaque && themeRndr->isElementOpaque(e+"-left");
+      if ( fs.right > 0 )
+        opaque = opaque && themeRndr->isElementOpaque(e+"-right");
+      if ( (fs.top > 0) && (fs.left > 0) )
+        opaque = opaque && themeRndr->isElementOpaque(e+"-topleft");
+      if ( (fs.top > 0) && (fs.right > 0) )
+        opaque = opaque && themeRndr->isElementOpaque(e+"-topright");
+      if ( (fs.bottom > 0) && (fs.left > 0) )
+        opaque = opaque && themeRndr->isElementOpaque(e+"-bottomleft");
+      if ( (fs.bottom > 0) && (fs.right > 0) )
+        opaque = opaque && themeRndr->isElementOpaque(e+"-bottomright");
+    }
+  }
+
+  if ( useConfigCache )
+    opacityCache.insert(key, opaque);
+
+  return opaque;
+}
+
 void QSvgThemableStyle::polish(QWidget * widget)
 {
   if ( !widget )
@@ -300,21 +796,27 @@ void QSvgThemableStyle::polish(QWidget * widget)
   }
 
   // Remove WA_OpaquePaintEvent from scrollbars to correctly render them
-  // when the svg items have non opaque colors
+  // when the svg items have non opaque colors. Keep it when the theme
+  // scroll bars are fully opaque: the parent background is then not
+  // painted behind them
   if ( QScrollBar *s = qobject_cast< QScrollBar* >(widget) ) {
-    s->setAttribute(Qt::WA_OpaquePaintEvent, false);
+    const QStringList states = QStringList() << "normal" << "disabled";
+    bool opaque = isGroupOpaque(CC_group(CC_ScrollBar), states);
+    if ( opaque &&
+         (getThemeTweak("specific.scrollbar.variant").toInt() == VA_SCROLLBAR_BUTTONS) )
+      opaque = isGroupOpaque(CE_group(CE_ScrollBarAddLine),
+                             QStringList(states) << "hovered" << "pressed");
+    s->setAttribute(Qt::WA_OpaquePaintEvent, opaque);
   }
 
-  // Install event filter on progress bars to animate them
-  if ( QProgressBar *b = qobject_cast< QProgressBar* >(widget) ) {
-    b->installEventFilter(this);
-  }
-
-  // Enable menu tear off, enable translucency
+  // Enable menu tear off, enable translucency unless the theme menus
+  // are fully opaque, in which case compositing is not needed
   if ( QMenu *m = qobject_cast< QMenu* >(widget) ) {
     if ( getThemeTweak("specific.menu.forcetearoff").toBool() )
       m->setTearOffEnabled(true);
-    m->setAttribute(Qt::WA_TranslucentBackground, true);
+    m->setAttribute(Qt::WA_TranslucentBackground,
+                    (quality != QualityFast) &&
+                    !isGroupOpaque(PE_group(PE_FrameMenu), QStringList() << "normal"));
   }
 
 #if 0
@@ -355,9 +857,269 @@ void QSvgThemableStyle::polish(QWidget * widget)
     h->setBackgroundRole(QPalette::Button);
   }
 
-  if ( QPushButton *s = qobject_cast< QPushButton * >(widget) ) {
-    s->installEventFilter(this);
+  // Install event filter on animated widgets to follow their visibility,
+  // and on complex controls to limit hover repaints to their sub controls
+  if ( isAnimatableWidget(widget) || isSubControlHoverWidget(widget) ||
+       countPaintArea ) {
+    widget->installEventFilter(this);
+  }
+
+  // Pre-render popups before they are first opened
+  if ( qobject_cast< QMenu * >(widget) || qobject_cast< QComboBox * >(widget) ||
+       (widget->isWindow() && (widget->windowType() != Qt::Popup) &&
+        (widget->windowType() != Qt::ToolTip)) ) {
+    schedulePrewarm(widget);
+  }
+}
+
+void QSvgThemableStyle::schedulePrewarm(QWidget *widget)
+{
+  // nothing would be kept
+  if ( !useConfigCache || !useShapeCache )
+    return;
+
+  if ( prewarmQueue.contains(widget) )
+    return;
+  prewarmQueue.append(widget);
+
+  if ( !prewarmTimer ) {
+    prewarmTimer = new QTimer(this);
+    prewarmTimer->setSingleShot(true);
+    prewarmTimer->setTimerType(Qt::VeryCoarseTimer);
+    connect(prewarmTimer,&QTimer::timeout,
+            this,&QSvgThemableStyle::slot_prewarmNext);
+  }
+
+  if ( !windowPainted ) {
+    // started once the first window is on screen, see eventFilter()
+    if ( widget->isWindow() )
+      widget->installEventFilter(this);
+    return;
+  }
+
+  if ( !prewarmTimer->isActive() )
+    prewarmTimer->start(1000);
+}
+
+void QSvgThemableStyle::slot_prewarmNext()
+{
+  // one widget per timeout, the application stays responsive
+  while ( !prewarmQueue.isEmpty() ) {
+    QPointer<QWidget> w = prewarmQueue.takeFirst();
+    if ( !w )
+      continue;
+
+    if ( QMenu *m = qobject_cast< QMenu * >(w) ) {
+      // already painted when opened meanwhile
+      if ( m->isVisible() )
+        continue;
+      prewarmMenu(m);
+    } else if ( QComboBox *c = qobject_cast< QComboBox * >(w) ) {
+      prewarmComboPopup(c);
+    } else {
+      prewarmToolTip(w);
+    }
+    break;
+  }
+
+  if ( !prewarmQueue.isEmpty() )
+    prewarmTimer->start(100);
+}
+
+void QSvgThemableStyle::prewarmMenu(const QMenu *menu)
+{
+  const qreal dpr = menu->devicePixelRatioF();
+  const QFont font = menu->font();
+  const QFontMetrics fm(font);
+
+  QStyleOptionMenuItem o;
+  o.initFrom(menu);
+  o.font = font;
+  o.text = "Menu item\tCtrl+M";
+  o.maxIconWidth = pixelMetric(PM_SmallIconSize,&o,menu);
+  o.reservedShortcutWidth = 0;
+  o.tabWidth = 0;
+  o.menuItemType = QStyleOptionMenuItem::Normal;
+  o.checkType = QStyleOptionMenuItem::NotCheckable;
+
+  const QSize itemSize = sizeFromContents(CT_MenuItem,&o,
+                                          QSize(fm.horizontalAdvance(o.text),fm.height()),
+                                          menu);
+  const int fw = pixelMetric(PM_MenuPanelWidth,&o,menu);
+
+  // Frames and items are cached by size. Use the size of the menu when
+  // it already has its actions, as QMenu lays them out. Menus filled
+  // just before being shown get a typical size: elements that only
+  // depend on item height (corners, edges, indicators) are warm anyway
+  QSize menuSize(itemSize.width()+2*fw,8*itemSize.height()+2*fw);
+  int itemWidth = itemSize.width();
+  if ( !menu->actions().isEmpty() ) {
+    menuSize = menu->sizeHint();
+    itemWidth = menuSize.width()-2*(fw+pixelMetric(PM_MenuHMargin,&o,menu));
   }
+
+  const QString key = QString("menu:%1:%2:%3x%4@%5")
+      .arg(font.key())
+      .arg(menu->palette().cacheKey())
+      .arg(menuSize.width())
+      .arg(menuSize.height())
+      .arg(dpr);
+
+  if ( prewarmed.contains(key) || (itemWidth <= 0) )
+    return;
+  prewarmed.insert(key);
+
+  const QRect menuRect(QPoint(0,0),menuSize);
+  o.menuRect = menuRect;
+
+  QPixmap scratch(menuRect.size()*dpr);
+  scratch.setDevicePixelRatio(dpr);
+  scratch.fill(Qt::transparent);
+  QPainter p(&scratch);
+
+  // panel and frame
+  QStyleOptionFrame f;
+  f.initFrom(menu);
+  f.rect = menuRect;
+  f.lineWidth = fw;
+  f.midLineWidth = 0;
+  drawPrimitive(PE_PanelMenu,&f,&p,menu);
+  drawPrimitive(PE_FrameMenu,&f,&p,menu);
+
+  // items in all their usual states
+  const QList<State> states = QList<State>()
+    << (State_Enabled)
+    << (State_Enabled | State_Selected)
+    << State_None;
+
+  QRect r(fw,fw,itemWidth,itemSize.height());
+
+  Q_FOREACH(State state, states) {
+    o.state = state | (menu->isActiveWindow() ? State_Active : State_None);
+    o.rect = r;
+
+    o.menuItemType = QStyleOptionMenuItem::Normal;
+    o.checkType = QStyleOptionMenuItem::NotCheckable;
+    o.checked = false;
+    drawControl(CE_MenuItem,&o,&p,menu);
+
+    o.checkType = QStyleOptionMenuItem::NonExclusive;
+    drawControl(CE_MenuItem,&o,&p,menu);
+    o.checked = true;
+    drawControl(CE_MenuItem,&o,&p,menu);
+
+    o.checkType = QStyleOptionMenuItem::Exclusive;
+    drawControl(CE_MenuItem,&o,&p,menu);
+    o.checked = false;
+    drawControl(CE_MenuItem,&o,&p,menu);
+
+    o.checkType = QStyleOptionMenuItem::NotCheckable;
+    o.menuItemType = QStyleOptionMenuItem::SubMenu;
+    drawControl(CE_MenuItem,&o,&p,menu);
+  }
+
+  // separator
+  o.state = State_Enabled;
+  o.menuItemType = QStyleOptionMenuItem::Separator;
+  o.text.clear();
+  o.rect = QRect(fw,fw,itemWidth,
+                 sizeFromContents(CT_MenuItem,&o,QSize(0,0),menu).height());
+  drawControl(CE_MenuItem,&o,&p,menu);
+}
+
+void QSvgThemableStyle::prewarmComboPopup(const QComboBox *combo)
+{
+  // nothing to size the popup from
+  if ( combo->count() == 0 )
+    return;
+
+  // the list view is inside a styled frame, the popup window. It is
+  // created here if the combo box was never opened
+  const QAbstractItemView *view = combo->view();
+  const QWidget *popup = view->window();
+  const qreal dpr = combo->devicePixelRatioF();
+
+  // The popup list is as wide as the combo box and shows at most
+  // maxVisibleItems rows. Combo boxes of hidden windows are not laid
+  // out yet and get their preferred width
+  QStyleOptionFrame f;
+  f.initFrom(popup);
+  f.frameShape = QFrame::StyledPanel;
+  f.lineWidth = pixelMetric(PM_DefaultFrameWidth,&f,popup);
+  f.midLineWidth = 0;
+
+  const int width = combo->isVisible() ? combo->width() : combo->sizeHint().width();
+  const int rowHeight = view->sizeHintForRow(0);
+  const int rows = qMin(combo->count(),combo->maxVisibleItems());
+  f.rect = QRect(0,0,width,rows*rowHeight+2*f.lineWidth);
+
+  const QString key = QString("combo:%1:%2:%3x%4@%5")
+      .arg(view->font().key())
+      .arg(view->palette().cacheKey())
+      .arg(f.rect.width())
+      .arg(f.rect.height())
+      .arg(dpr);
+
+  if ( prewarmed.contains(key) || (rowHeight <= 0) ||
+       (width <= 2*f.lineWidth) )
+    return;
+  prewarmed.insert(key);
+
+  QPixmap scratch(f.rect.size()*dpr);
+  scratch.setDevicePixelRatio(dpr);
+  scratch.fill(Qt::transparent);
+  QPainter p(&scratch);
+
+  drawPrimitive(PE_Frame,&f,&p,popup);
+
+  // rows in normal state keep the list background, only the current
+  // and hovered ones are painted
+  QStyleOptionViewItem o;
+  o.initFrom(view);
+  o.rect = QRect(f.lineWidth,f.lineWidth,width-2*f.lineWidth,rowHeight);
+  o.showDecorationSelected = styleHint(SH_ItemView_ShowDecorationSelected,&o,view);
+
+  const QList<State> states = QList<State>()
+    << (State_Enabled | State_Selected | State_Active)
+    << (State_Enabled | State_MouseOver | State_Active);
+
+  Q_FOREACH(State state, states) {
+    o.state = state;
+    drawPrimitive(PE_PanelItemViewItem,&o,&p,view);
+  }
+}
+
+void QSvgThemableStyle::prewarmToolTip(const QWidget *window)
+{
+  const qreal dpr = window->devicePixelRatioF();
+  const QFont font = QToolTip::font();
+  const QString key = QString("tooltip:%1:%2@%3")
+      .arg(font.key())
+      .arg(QToolTip::palette().cacheKey())
+      .arg(dpr);
+
+  if ( prewarmed.contains(key) )
+    return;
+  prewarmed.insert(key);
+
+  // one line tooltip
+  const QFontMetrics fm(font);
+  QStyleOptionFrame o;
+  o.initFrom(window);
+  o.palette = QToolTip::palette();
+  o.state = State_Enabled;
+  o.lineWidth = pixelMetric(PM_ToolTipLabelFrameWidth,&o,nullptr);
+  o.midLineWidth = 0;
+  o.rect = QRect(0,0,
+                 fm.horizontalAdvance("Tooltip text")+2*o.lineWidth,
+                 fm.height()+2*o.lineWidth);
+
+  QPixmap scratch(o.rect.size()*dpr);
+  scratch.setDevicePixelRatio(dpr);
+  scratch.fill(Qt::transparent);
+  QPainter p(&scratch);
+
+  drawPrimitive(PE_PanelTipLabel,&o,&p,nullptr);
 }
 
 void QSvgThemableStyle::unpolish(QWidget * widget)
@@ -369,27 +1131,12 @@ void QSvgThemableStyle::unpolish(QWidget * widget)
      animatedWidgets.removeOne(widget);
    }*/
 
-  if ( qobject_cast< const QProgressBar* >(widget) ) {
-    progressbars.remove(widget);
-  }
+  animations->stopAll(widget);
+  transitions.remove(widget);
 
   widget->removeEventFilter(this);
 }
 
-void QSvgThemableStyle::slot_animateProgressBars()
-{
-  QMap<QWidget *,int>::iterator it;
-  for (it=progressbars.begin(); it!=progressbars.end(); ++it) {
-
-    QWidget *widget = it.key();
-    if (widget->isVisible() && (qobject_cast< const QProgressBar* >(widget)->value() <= 0)) {
-      // only update busy progress bars
-      it.value() += 2;
-      widget->update();
-    }
-  }
-}
-
 QRect QSvgThemableStyle::tabRect(const QStyleOption *option, const QWidget *widget) const
 {
   int x,y,w,h;
@@ -548,23 +1295,44 @@ bool QSvgThemableStyle::eventFilter(QObject* o, QEvent* e)
   QWidget *w = qobject_cast< QWidget* >(o);
 
   switch ( e->type() ) {
-  case QEvent::Show:
-    if ( w ) {
-      if ( qobject_cast< QProgressBar * >(o) ) {
-        progressbars.insert(w, 0);
-        if ( !progresstimer->isActive() )
-          progresstimer->start(50);
-      }
-    }
-    break;
-
   case QEvent::Hide:
   case QEvent::Destroy:
     if (w) {
       animatedWidgets.removeOne(w);
-      progressbars.remove(w);
-      if ( progressbars.size() == 0 )
-        progresstimer->stop();
+      transitions.remove(w);
+    }
+    break;
+
+  case QEvent::HoverEnter:
+  case QEvent::HoverLeave: {
+    // QWidget repaints the whole widget when the mouse enters or leaves
+    // it. Instead, let the widget update its hovered sub control as on
+    // a mouse move, then only repaint what depends on the widget hover
+    // state
+    QRegion region;
+    if ( w && isSubControlHoverWidget(w) && hoverUpdateRegion(w,region) ) {
+      const QHoverEvent *he = static_cast<QHoverEvent *>(e);
+      QHoverEvent move(QEvent::HoverMove, he->position(), he->globalPosition(),
+                       he->oldPosF(), he->modifiers(), he->pointingDevice());
+      QCoreApplication::sendEvent(w,&move);
+      if ( !region.isEmpty() )
+        w->update(region);
+      return true;
+    }
+    break;
+  }
+
+  case QEvent::Paint:
+    if ( countPaintArea ) {
+      Q_FOREACH(const QRect &r, static_cast<QPaintEvent *>(e)->region()) {
+        paintArea += (quint64)r.width()*r.height();
+      }
+    }
+
+    // startup is over: pre-render popups from now on
+    if ( w && w->isWindow() && !windowPainted && prewarmTimer ) {
+      windowPainted = true;
+      prewarmTimer->start(1000);
     }
     break;
 
@@ -580,6 +1348,19 @@ void QSvgThemableStyle::drawPrimitive(PrimitiveElement e, const QStyleOption * o
 {
   emit sig_drawPrimitive_begin(PE_str(e));
 
+  // repainted when the renderings it waits for are ready. Restored at
+  // the end: nested calls may paint other widgets
+  const QWidget *target = NULL;
+  if ( isGuiThread() ) {
+    target = themeRndr->currentPaintTarget();
+    themeRndr->setPaintTarget(widget);
+  }
+
+  // fast profile: no antialiasing nor smooth pixmap scaling
+  const QPainter::RenderHints hints = p->renderHints();
+  if ( quality == QualityFast )
+    p->setRenderHints(QPainter::Antialiasing | QPainter::SmoothPixmapTransform, false);
+
   // Copy some values into shorter variable names
   int x,y,w,h;
   QRect r = option->rect;
@@ -593,6 +1374,13 @@ void QSvgThemableStyle::drawPrimitive(PrimitiveElement e, const QStyleOption * o
   // Get QSvgStyle configuration group used to render this element
   QString g = PE_group(e);
 
+  // groups of the composites built by this call and the nested ones
+  if ( trackChanges && isGuiThread() ) {
+    if ( drawDepth++ == 0 )
+      drawGroups.clear();
+    drawGroups.insert(g);
+  }
+
   // Configuration for group g
   frame_spec_t fs;
   interior_spec_t is;
@@ -608,6 +1396,9 @@ void QSvgThemableStyle::drawPrimitive(PrimitiveElement e, const QStyleOption * o
     goto end;
   }
 
+  if ( trackChanges && widget && isGuiThread() )
+    changeTrackedUsers[widget].insert(g);
+
   // Get configuration for group
   fs = getFrameSpec(g);
   is = getInteriorSpec(g);
@@ -991,34 +1782,60 @@ void QSvgThemableStyle::drawPrimitive(PrimitiveElement e, const QStyleOption * o
       o.state &= ~(State_Sunken | State_On);
       st = state_str(o.state,widget);
       bg = bgBrush(ps,option,widget,st);
-      renderFrame(p,bg,r,fs,fs.element+"-"+st,dir);
-      if ( focus ) {
-        renderFrame(p,QBrush(),r,fs,fs.element+"-focused",dir);
-      }
+
+      // cached per size, state and focus: caret blinks and
+      // keystrokes only cost a blit
+      const QString key = QString("framelineedit:%1:%2:%3:%4:%5")
+          .arg(g)
+          .arg(st)
+          .arg(focus)
+          .arg((int)dir)
+          .arg(brushKey(bg));
+
+      renderComposite(p,brushKey(bg).isEmpty() ? QString() : key,r,[&](QPainter *p) {
+        renderFrame(p,bg,r,fs,fs.element+"-"+st,dir);
+        if ( focus ) {
+          renderFrame(p,QBrush(),r,fs,fs.element+"-focused",dir);
+        }
+      });
       break;
     }
     case PE_PanelLineEdit : {
       // Interior and frame for line edits
-      if ( const QStyleOptionFrame *opt =
-           qstyleoption_cast<const QStyleOptionFrame *>(option) ) {
-        if ( opt->lineWidth > 0 ) {
-          // NOTE QLineEdit sets lineWidth to PM_DefaultFrameWidth
-          // when line edit has a frame
-          drawPrimitive(PE_FrameLineEdit,option,p,widget);
-        } else
-          fs.hasFrame = false;
-      }
-      // NOTE LineEdits have always State_Sunken (see
-      // QLineEdit.cpp::initStyleOption()). Remove it
-      // QSvgStyle remove also State_On
-      QStyleOption o(*option);
-      o.state &=  ~ (State_Sunken | State_On);
-      st = state_str(o.state,widget);
-      bg = bgBrush(ps,option,widget,st);
-      renderInterior(p,bg,r,fs,is,is.element+"-"+st,dir);
-      if ( focus ) {
-        renderInterior(p,QBrush(),r,fs,is,is.element+"-focused",dir);
-      }
+      const QStyleOptionFrame *opt =
+        qstyleoption_cast<const QStyleOptionFrame *>(option);
+
+      const QString key = QString("lineedit:%1:%2:%3:%4")
+          .arg(g)
+          .arg((int)dir)
+          .arg(opt ? opt->lineWidth : -1)
+          .arg(paletteKey(option));
+
+      renderTransition(p,widget,key,r,option->state,[&](QPainter *p, State state) {
+        frame_spec_t f = fs;
+
+        if ( opt ) {
+          if ( opt->lineWidth > 0 ) {
+            // NOTE QLineEdit sets lineWidth to PM_DefaultFrameWidth
+            // when line edit has a frame
+            QStyleOptionFrame fo(*opt);
+            fo.state = state;
+            drawPrimitive(PE_FrameLineEdit,&fo,p,widget);
+          } else
+            f.hasFrame = false;
+        }
+        // NOTE LineEdits have always State_Sunken (see
+        // QLineEdit.cpp::initStyleOption()). Remove it
+        // QSvgStyle remove also State_On
+        QStyleOption o(*option);
+        o.state = state & ~(State_Sunken | State_On);
+        const QString s = state_str(o.state,widget);
+        const QBrush b = bgBrush(ps,&o,widget,s);
+        renderInterior(p,b,r,f,is,is.element+"-"+s,dir);
+        if ( state & State_HasFocus ) {
+          renderInterior(p,QBrush(),r,f,is,is.element+"-focused",dir);
+        }
+      });
       break;
     }
     case PE_PanelToolBar : {
@@ -1175,29 +1992,51 @@ void QSvgThemableStyle::drawPrimitive(PrimitiveElement e, const QStyleOption * o
             fs.capsuleH = 0;
 
           // view items have their own brushes
-          QBrush br = p->brush();
-          QPen pn = p->pen();
-          p->setBrush(opt->backgroundBrush);
-          p->setPen(Qt::NoPen);
-          p->drawRect(r);
-          p->setBrush(br);
-          p->setPen(pn);
+          if ( opt->backgroundBrush.style() != Qt::NoBrush ) {
+            QBrush br = p->brush();
+            QPen pn = p->pen();
+            p->setBrush(opt->backgroundBrush);
+            p->setPen(Qt::NoPen);
+            p->drawRect(r);
+            p->setBrush(br);
+            p->setPen(pn);
+          }
+
+          // only paint when state is not normal, otherwise keep
+          // container widget background
+          const bool paintState = (st != "normal");
+
+          // nothing else to draw: skip the frame work entirely
+          if ( (!paintState && !focus) || (!fs.hasFrame && !is.hasInterior) )
+            break;
 
           if ( st == "toggled" ) {
             bg = opt->palette.brush(QPalette::Highlight);
           }
 
-          if ( st != "normal" ) {
-            // only paint when state is not normal, otherwise keep
-            // container widget background
-            renderFrame(p,bg,r,fs,fs.element+"-"+st,dir);
-            renderInterior(p,bg,r,fs,is,is.element+"-"+st,dir);
-          }
+          // Rows of large views are all alike: render them once per
+          // size and state, then blit
+          const QString bk = brushKey(bg);
+          const QString key = bk.isEmpty() ? QString() :
+            QString("viewitem:%1:%2:%3:%4:%5:%6")
+              .arg(g)
+              .arg(st)
+              .arg(fs.capsuleH)
+              .arg(focus)
+              .arg((int)dir)
+              .arg(bk);
+
+          renderComposite(p,key,r,[&](QPainter *p) {
+            if ( paintState ) {
+              renderFrame(p,bg,r,fs,fs.element+"-"+st,dir);
+              renderInterior(p,bg,r,fs,is,is.element+"-"+st,dir);
+            }
 
-          if ( focus ) {
-            renderFrame(p,bg,r,fs,fs.element+"-focused",dir);
-            renderInterior(p,QBrush(),r,fs,is,is.element+"-focused",dir);
-          }
+            if ( focus ) {
+              renderFrame(p,bg,r,fs,fs.element+"-focused",dir);
+              renderInterior(p,QBrush(),r,fs,is,is.element+"-focused",dir);
+            }
+          });
         }
       break;
     }
@@ -1212,13 +2051,33 @@ void QSvgThemableStyle::drawPrimitive(PrimitiveElement e, const QStyleOption * o
   }
 
 end:
+  if ( trackChanges && isGuiThread() )
+    drawDepth--;
+  if ( isGuiThread() )
+    themeRndr->setPaintTarget(target);
   emit sig_drawPrimitive_end(PE_str(e));
+
+  if ( quality == QualityFast )
+    p->setRenderHints(hints & (QPainter::Antialiasing | QPainter::SmoothPixmapTransform), true);
 }
 
 void QSvgThemableStyle::drawControl(ControlElement e, const QStyleOption * option, QPainter * p, const QWidget * widget) const
 {
   emit sig_drawControl_begin(CE_str(e));
 
+  // repainted when the renderings it waits for are ready. Restored at
+  // the end: nested calls may paint other widgets
+  const QWidget *target = NULL;
+  if ( isGuiThread() ) {
+    target = themeRndr->currentPaintTarget();
+    themeRndr->setPaintTarget(widget);
+  }
+
+  // fast profile: no antialiasing nor smooth pixmap scaling
+  const QPainter::RenderHints hints = p->renderHints();
+  if ( quality == QualityFast )
+    p->setRenderHints(QPainter::Antialiasing | QPainter::SmoothPixmapTransform, false);
+
   // Copy some values into shorter variable names
   int x,y,w,h;
   QRect r = option->rect;
@@ -1234,6 +2093,13 @@ void QSvgThemableStyle::drawControl(ControlElement e, const QStyleOption * optio
   // Get QSvgStyle configuration group used to render this element
   QString g = CE_group(e);
 
+  // groups of the composites built by this call and the nested ones
+  if ( trackChanges && isGuiThread() ) {
+    if ( drawDepth++ == 0 )
+      drawGroups.clear();
+    drawGroups.insert(g);
+  }
+
   // Configuration for group g
   frame_spec_t fs;
   interior_spec_t is;
@@ -1249,6 +2115,9 @@ void QSvgThemableStyle::drawControl(ControlElement e, const QStyleOption * optio
     goto end;
   }
 
+  if ( trackChanges && widget && isGuiThread() )
+    changeTrackedUsers[widget].insert(g);
+
   // Get configuration for group
   fs = getFrameSpec(g);
   is = getInteriorSpec(g);
@@ -1272,30 +2141,44 @@ void QSvgThemableStyle::drawControl(ControlElement e, const QStyleOption * optio
       if ( const QStyleOptionButton *opt =
            qstyleoption_cast<const QStyleOptionButton *>(option) ) {
 
-        QStyleOptionButton o(*opt);
+        bool capsule = false;
+        int capsuleH = 0, capsuleV = 0;
+        computeButtonCapsule(widget,capsule,capsuleH,capsuleV);
 
-        bool nonflat = false;
+        const QString key = QString("bevel:%1:%2:%3:%4:%5")
+            .arg(g)
+            .arg((int)opt->features)
+            .arg((int)dir)
+            .arg(capsule ? capsuleH*3+capsuleV : -10)
+            .arg(paletteKey(option));
 
-        if ( opt->features & QStyleOptionButton::Flat ) {
-          // flat buttons: only applicable to normal state
-          if ( (option->state & State_Enabled) &&
-                ((option->state & State_Sunken) ||
-                (option->state & State_On) ||
-                (option->state & State_MouseOver))
-              ) {
+        renderTransition(p,widget,key,r,option->state,[&](QPainter *p, State state) {
+          QStyleOptionButton o(*opt);
+          o.state = state;
+
+          bool nonflat = false;
+
+          if ( opt->features & QStyleOptionButton::Flat ) {
+            // flat buttons: only applicable to normal state
+            if ( (state & State_Enabled) &&
+                  ((state & State_Sunken) ||
+                  (state & State_On) ||
+                  (state & State_MouseOver))
+                ) {
+              nonflat = true;
+            }
+          } else {
             nonflat = true;
           }
-        } else {
-          nonflat = true;
-        }
 
-        if ( opt->features & QStyleOptionButton::DefaultButton )
-          drawPrimitive(PE_FrameDefaultButton,&o,p,widget);
+          if ( opt->features & QStyleOptionButton::DefaultButton )
+            drawPrimitive(PE_FrameDefaultButton,&o,p,widget);
 
-        if ( nonflat ) {
-          drawPrimitive(PE_FrameButtonBevel,&o,p,widget);
-          drawPrimitive(PE_PanelButtonBevel,option,p,widget);
-        }
+          if ( nonflat ) {
+            drawPrimitive(PE_FrameButtonBevel,&o,p,widget);
+            drawPrimitive(PE_PanelButtonBevel,&o,p,widget);
+          }
+        });
       }
 
       break;
@@ -2024,7 +2907,10 @@ void QSvgThemableStyle::drawControl(ControlElement e, const QStyleOption * optio
         is.px = pixelMetric(PM_ProgressBarChunkWidth);
 
         if ( opt->progress >= 0 ) {
-          // Normal progress bar
+          // Normal progress bar. The scheduler belongs to the GUI thread
+          if ( widget && isGuiThread() )
+            animations->stop(widget, QSvgAnimationScheduler::BusyProgressBar);
+
           int empty = sliderPositionFromValue(opt->minimum,
                                               opt->maximum,
                                               opt->maximum-opt->progress,
@@ -2077,69 +2963,176 @@ void QSvgThemableStyle::drawControl(ControlElement e, const QStyleOption * optio
         } else { // busy progressbar
           int variant = getThemeTweak("specific.progressbar.busy.variant").toInt();
 
-          QWidget *wd = (QWidget *)widget;
-          int animcount = progressbars[wd];
+          // the busy indicator moves 2 pixels every 50 ms, by 1 pixel
+          // steps when repainted every 25 ms
+          int animcount = 0;
+          if ( widget && isGuiThread() ) {
+            QWidget *wd = (QWidget *)widget;
+            // lower quality profiles repaint less often, at the same speed
+            const int step = (quality == QualityHigh) ? 25 :
+                             (quality == QualityBalanced) ? 50 : 100;
+            animations->start(wd, QSvgAnimationScheduler::BusyProgressBar, step);
+            // only the contents need to be repainted
+            animations->setUpdateRect(wd, QSvgAnimationScheduler::BusyProgressBar,
+                                      option->rect);
+            animcount = animations->elapsed(wd, QSvgAnimationScheduler::BusyProgressBar)/25;
+          }
           int pm = w;
           if ( is.px > 0 )
             pm = is.px; // cursor size
 
-          switch (variant) {
-            case VA_PROGRESSBAR_BUSY_WRAP : {
-              r = r.adjusted(animcount%w,0,0,0);
-              r.setWidth(pm);
-
-              // add frame again
-              r = r.adjusted(-fs.left,-fs.top,fs.right,fs.bottom);
-
-              QRect cr = r; // Clip rect for r
-
-              if ( r.x()+r.width()-1 > x+w-1 ) {
-                // two half cursors
-                // wrap busy indicator: second cursor size
-                int pm2 = x+w-r.x();
-
-                cr.setWidth(pm2);
-
-                // left part of frame: only show if cursor is at the beginning
-                if ( r.left() <= orig.left() )
-                  cr = cr.adjusted(fs.left,0,0,0);
-
-                // right part of frame: only show if cursor is at the end
-                if ( r.right() >= orig.right() )
-                  cr = cr.adjusted(0,0,-fs.right,0);
+          // The animation is periodic. The full length variant has pm
+          // frames, each composed once per size and state. The cursor
+          // of the other variants is composed once and moved
+          if ( (variant != VA_PROGRESSBAR_BUSY_WRAP) &&
+               (variant != VA_PROGRESSBAR_BUSY_BACKANDFORTH) )
+            animcount = animcount%qMax(1,pm);
+
+          const QString bk = brushKey(bg);
+          const QString key = bk.isEmpty() ? QString() :
+            QString("busy:%1:%2:%3:%4:%5:%6:%7:%8")
+              .arg(getThemeTweak("specific.progressbar.busy.full.variant").toInt())
+              .arg(fs.element+"/"+is.element+"-elapsed-"+st)
+              .arg((int)orn)
+              .arg((int)dir)
+              .arg(opt->invertedAppearance)
+              .arg(animcount)
+              .arg(bk)
+              .arg(pm);
+          const QString cursorKey = bk.isEmpty() ? QString() :
+            QString("busycursor:%1:%2:%3:%4")
+              .arg(fs.element+"/"+is.element+"-elapsed-"+st)
+              .arg((int)orn)
+              .arg((int)dir)
+              .arg(bk);
+
+          // cursor of the wrap and back and forth variants, its rect only
+          // depends on the size so it is composed once
+          auto renderCursor = [&](QPainter *p, const QRect &cursor, bool withFrame) {
+            renderComposite(p, cursorKey.isEmpty() ? QString() :
+                                 cursorKey+(withFrame ? ":frame" : ":interior"),
+                            cursor, [&](QPainter *p) {
+              if ( withFrame )
+                renderFrame(p,bg,cursor,fs,fs.element+"-elapsed-"+st,dir,orn);
+              renderInterior(p,bg,cursor,fs,is,is.element+"-elapsed-"+st,dir,orn);
+            });
+          };
+
+          const std::function<void (QPainter *)> busy = [&](QPainter *p) {
+            switch (variant) {
+              case VA_PROGRESSBAR_BUSY_WRAP : {
+                r = r.adjusted(animcount%w,0,0,0);
+                r.setWidth(pm);
 
-                if ( orn == Horizontal ) {
-                  r = visualRect(dir,orig,r);
-                  cr = visualRect(dir,orig,cr);
-                }
+                // add frame again
+                r = r.adjusted(-fs.left,-fs.top,fs.right,fs.bottom);
 
-                if ( opt->invertedAppearance ) {
-                  r = visualRect(Qt::RightToLeft,orig,r);
-                  cr = visualRect(Qt::RightToLeft,orig,cr);
+                QRect cr = r; // Clip rect for r
+
+                if ( r.x()+r.width()-1 > x+w-1 ) {
+                  // two half cursors
+                  // wrap busy indicator: second cursor size
+                  int pm2 = x+w-r.x();
+
+                  cr.setWidth(pm2);
+
+                  // left part of frame: only show if cursor is at the beginning
+                  if ( r.left() <= orig.left() )
+                    cr = cr.adjusted(fs.left,0,0,0);
+
+                  // right part of frame: only show if cursor is at the end
+                  if ( r.right() >= orig.right() )
+                    cr = cr.adjusted(0,0,-fs.right,0);
+
+                  if ( orn == Horizontal ) {
+                    r = visualRect(dir,orig,r);
+                    cr = visualRect(dir,orig,cr);
+                  }
+
+                  if ( opt->invertedAppearance ) {
+                    r = visualRect(Qt::RightToLeft,orig,r);
+                    cr = visualRect(Qt::RightToLeft,orig,cr);
+                  }
+
+                  p->save();
+                  p->setClipRect(r.x(),r.y(),pm2,r.height());
+                  renderCursor(p,(orn != Horizontal) ? transposedRect(r) : r,false);
+                  p->restore();
+
+                  // now the second cursor
+                  r = QRect(orig.x()-pm2,orig.y(),pm,h);
+                  // add frame again
+                  r = r.adjusted(-fs.left,-fs.top,fs.right,fs.bottom);
+                  cr = r;
+
+                  // left part of frame: only show if cursor is at the beginning
+                  if ( r.left() <= orig.left() )
+                    cr = cr.adjusted(fs.left,0,0,0);
+
+                  // right part of frame: only show if cursor is at the end
+                  if ( r.right() >= orig.right() )
+                    cr = cr.adjusted(0,0,-fs.right,0);
+
+                  if ( orn == Horizontal ) {
+                    r = visualRect(dir,orig,r);
+                    cr = visualRect(dir,orig,cr);
+                  }
+
+                  if ( opt->invertedAppearance ) {
+                    r = visualRect(Qt::RightToLeft,orig,r);
+                    cr = visualRect(Qt::RightToLeft,orig,cr);
+                  }
+
+                  p->save();
+                  p->setClipRect(orig.x(),orig.y(),pm,h);
+                  renderCursor(p,(orn != Horizontal) ? transposedRect(r) : r,false);
+                  p->restore();
+                } else {
+                  // single cursor
+                  // left part of frame: only show if cursor is at the beginning
+                  if ( r.left() > orig.left() )
+                    cr = cr.adjusted(fs.left,0,0,0);
+
+                  // right part of frame: only show if cursor is at the end
+                  if ( r.right() < orig.right() )
+                    cr = cr.adjusted(0,0,-fs.right,0);
+
+                  if ( orn == Horizontal ) {
+                    r = visualRect(dir,orig,r);
+                    cr = visualRect(dir,orig,cr);
+                  }
+
+                  if ( opt->invertedAppearance ) {
+                    r = visualRect(Qt::RightToLeft,orig,r);
+                    cr = visualRect(Qt::RightToLeft,orig,cr);
+                  }
+
+                  if ( orn != Horizontal )
+                    cr = transposedRect(cr);
+
+                  p->save();
+                  p->setClipRect(cr);
+                  renderCursor(p,(orn != Horizontal) ? transposedRect(r) : r,true);
+                  p->restore();
                 }
+                break;
+              }
+              case VA_PROGRESSBAR_BUSY_BACKANDFORTH : {
+                r = r.adjusted(animcount%(2*(w-pm+1)),0,0,0);
+                if ( r.x()+pm-1 > x+w-1 )
+                  r.setX(x+2*(w-pm+1)-r.x());
+                r.setWidth(pm);
 
-                p->save();
-                p->setClipRect(r.x(),r.y(),pm2,r.height());
-                renderInterior(p,bg,
-                              (orn != Horizontal) ? transposedRect(r) : r,
-                              fs,is,
-                              is.element+"-elapsed-"+st,
-                              dir,
-                              orn);
-                p->restore();
-
-                // now the second cursor
-                r = QRect(orig.x()-pm2,orig.y(),pm,h);
                 // add frame again
                 r = r.adjusted(-fs.left,-fs.top,fs.right,fs.bottom);
-                cr = r;
 
+                QRect cr = r; // Clip rect for r
                 // left part of frame: only show if cursor is at the beginning
-                if ( r.left() <= orig.left() )
+                if ( r.left() > orig.left() )
                   cr = cr.adjusted(fs.left,0,0,0);
 
                 // right part of frame: only show if cursor is at the end
-                if ( r.right() >= orig.right() )
+                if ( r.right() < orig.right() )
                   cr = cr.adjusted(0,0,-fs.right,0);
 
                 if ( orn == Horizontal ) {
@@ -2152,24 +3145,28 @@ void QSvgThemableStyle::drawControl(ControlElement e, const QStyleOption * optio
                   cr = visualRect(Qt::RightToLeft,orig,cr);
                 }
 
+                if ( orn != Horizontal )
+                  cr = transposedRect(cr);
+
                 p->save();
-                p->setClipRect(orig.x(),orig.y(),pm,h);
-                renderInterior(p,bg,
-                              (orn != Horizontal) ? transposedRect(r) : r,
-                              fs,is,
-                              is.element+"-elapsed-"+st,
-                              dir,
-                              orn);
+                p->setClipRect(cr);
+                renderCursor(p,(orn != Horizontal) ? transposedRect(r) : r,true);
                 p->restore();
-              } else {
-                // single cursor
-                // left part of frame: only show if cursor is at the beginning
-                if ( r.left() > orig.left() )
-                  cr = cr.adjusted(fs.left,0,0,0);
 
-                // right part of frame: only show if cursor is at the end
-                if ( r.right() < orig.right() )
-                  cr = cr.adjusted(0,0,-fs.right,0);
+                break;
+              }
+              case VA_PROGRESSBAR_BUSY_FULLLENGTH :
+              default: {
+                int ni = animcount%pm;
+                if ( getThemeTweak("specific.progressbar.busy.full.variant").toInt() ==
+                     VA_PROGRESSBAR_BUSY_FULLLENGTH_DIRECTION_FWD )
+                  ni = pm-ni;
+                r.adjust(-ni,0,w+ni,0);
+
+                // add frame again
+                r = r.adjusted(-fs.left,-fs.top,fs.right,fs.bottom);
+
+                QRect cr = orig.adjusted(fs.left,0,-fs.right,0); // Clip rect for r
 
                 if ( orn == Horizontal ) {
                   r = visualRect(dir,orig,r);
@@ -2184,14 +3181,15 @@ void QSvgThemableStyle::drawControl(ControlElement e, const QStyleOption * optio
                 if ( orn != Horizontal )
                   cr = transposedRect(cr);
 
-                p->save();
-                p->setClipRect(cr);
+                // render whole frame
                 renderFrame(p,bg,
-                               (orn != Horizontal) ? transposedRect(r) : r,
+                               (orn != Horizontal) ? transposedRect(orig) : orig,
                                fs,fs.element+"-elapsed-"+st,
                                dir,
                                orn);
 
+                p->save();
+                p->setClipRect(cr);
                 renderInterior(p,bg,
                               (orn != Horizontal) ? transposedRect(r) : r,
                               fs,is,
@@ -2199,104 +3197,17 @@ void QSvgThemableStyle::drawControl(ControlElement e, const QStyleOption * optio
                               dir,
                               orn);
                 p->restore();
-              }
-              break;
-            }
-            case VA_PROGRESSBAR_BUSY_BACKANDFORTH : {
-              r = r.adjusted(animcount%(2*(w-pm+1)),0,0,0);
-              if ( r.x()+pm-1 > x+w-1 )
-                r.setX(x+2*(w-pm+1)-r.x());
-              r.setWidth(pm);
-
-              // add frame again
-              r = r.adjusted(-fs.left,-fs.top,fs.right,fs.bottom);
-
-              QRect cr = r; // Clip rect for r
-              // left part of frame: only show if cursor is at the beginning
-              if ( r.left() > orig.left() )
-                cr = cr.adjusted(fs.left,0,0,0);
-
-              // right part of frame: only show if cursor is at the end
-              if ( r.right() < orig.right() )
-                cr = cr.adjusted(0,0,-fs.right,0);
 
-              if ( orn == Horizontal ) {
-                r = visualRect(dir,orig,r);
-                cr = visualRect(dir,orig,cr);
-              }
-
-              if ( opt->invertedAppearance ) {
-                r = visualRect(Qt::RightToLeft,orig,r);
-                cr = visualRect(Qt::RightToLeft,orig,cr);
+                break;
               }
-
-              if ( orn != Horizontal )
-                cr = transposedRect(cr);
-
-              p->save();
-              p->setClipRect(cr);
-              renderFrame(p,bg,
-                             (orn != Horizontal) ? transposedRect(r) : r,
-                             fs,fs.element+"-elapsed-"+st,
-                             dir,
-                             orn);
-
-              renderInterior(p,bg,
-                            (orn != Horizontal) ? transposedRect(r) : r,
-                            fs,is,
-                            is.element+"-elapsed-"+st,
-                            dir,
-                            orn);
-              p->restore();
-
-              break;
             }
-            case VA_PROGRESSBAR_BUSY_FULLLENGTH :
-            default: {
-              int ni = animcount%pm;
-              if ( getThemeTweak("specific.progressbar.busy.full.variant").toInt() ==
-                   VA_PROGRESSBAR_BUSY_FULLLENGTH_DIRECTION_FWD )
-                ni = pm-ni;
-              r.adjust(-ni,0,w+ni,0);
-
-              // add frame again
-              r = r.adjusted(-fs.left,-fs.top,fs.right,fs.bottom);
+          };
 
-              QRect cr = orig.adjusted(fs.left,0,-fs.right,0); // Clip rect for r
-
-              if ( orn == Horizontal ) {
-                r = visualRect(dir,orig,r);
-                cr = visualRect(dir,orig,cr);
-              }
-
-              if ( opt->invertedAppearance ) {
-                r = visualRect(Qt::RightToLeft,orig,r);
-                cr = visualRect(Qt::RightToLeft,orig,cr);
-              }
-
-              if ( orn != Horizontal )
-                cr = transposedRect(cr);
-
-              // render whole frame
-              renderFrame(p,bg,
-                             (orn != Horizontal) ? transposedRect(orig) : orig,
-                             fs,fs.element+"-elapsed-"+st,
-                             dir,
-                             orn);
-
-              p->save();
-              p->setClipRect(cr);
-              renderInterior(p,bg,
-                            (orn != Horizontal) ? transposedRect(r) : r,
-                            fs,is,
-                            is.element+"-elapsed-"+st,
-                            dir,
-                            orn);
-              p->restore();
-
-              break;
-            }
-          }
+          if ( (variant == VA_PROGRESSBAR_BUSY_WRAP) ||
+               (variant == VA_PROGRESSBAR_BUSY_BACKANDFORTH) )
+            busy(p);
+          else
+            renderComposite(p, key, option->rect, busy);
         }
       }
 
@@ -2337,12 +3248,18 @@ void QSvgThemableStyle::drawControl(ControlElement e, const QStyleOption * optio
         if ( opt->activeSubControls & SC_ScrollBarAddLine )
           o.state = opt->state;
         st = state_str(o.state,widget);
-        renderFrame(p,bg,option->rect,fs,fs.element+"-"+st,dir,orn);
-        renderInterior(p,bg,option->rect,fs,is,is.element+"-"+st,dir,orn);
-        if (option->state & State_Horizontal)
-            renderIndicator(p,r,fs,is,ds,ds.element+"-right-"+st,dir);
-        else
-            renderIndicator(p,r,fs,is,ds,ds.element+"-down-"+st,dir);
+        const QString bk = brushKey(bg);
+        renderComposite(p,
+                        bk.isEmpty() ? QString() :
+                          QString("sbaddline:%1:%2:%3:%4:%5").arg(g).arg(st).arg((int)orn).arg((int)dir).arg(bk),
+                        option->rect,[&](QPainter *p) {
+          renderFrame(p,bg,option->rect,fs,fs.element+"-"+st,dir,orn);
+          renderInterior(p,bg,option->rect,fs,is,is.element+"-"+st,dir,orn);
+          if (option->state & State_Horizontal)
+              renderIndicator(p,r,fs,is,ds,ds.element+"-right-"+st,dir);
+          else
+              renderIndicator(p,r,fs,is,ds,ds.element+"-down-"+st,dir);
+        });
       }
       break;
     }
@@ -2356,12 +3273,18 @@ void QSvgThemableStyle::drawControl(ControlElement e, const QStyleOption * optio
         if ( opt->activeSubControls & SC_ScrollBarSubLine )
           o.state = opt->state;
         st = state_str(o.state,widget);
-        renderFrame(p,bg,option->rect,fs,fs.element+"-"+st,dir,orn);
-        renderInterior(p,bg,option->rect,fs,is,is.element+"-"+st,dir,orn);
-        if (option->state & State_Horizontal)
-            renderIndicator(p,r,fs,is,ds,ds.element+"-left-"+st,dir);
-        else
-            renderIndicator(p,r,fs,is,ds,ds.element+"-up-"+st,dir);
+        const QString bk = brushKey(bg);
+        renderComposite(p,
+                        bk.isEmpty() ? QString() :
+                          QString("sbsubline:%1:%2:%3:%4:%5").arg(g).arg(st).arg((int)orn).arg((int)dir).arg(bk),
+                        option->rect,[&](QPainter *p) {
+          renderFrame(p,bg,option->rect,fs,fs.element+"-"+st,dir,orn);
+          renderInterior(p,bg,option->rect,fs,is,is.element+"-"+st,dir,orn);
+          if (option->state & State_Horizontal)
+              renderIndicator(p,r,fs,is,ds,ds.element+"-left-"+st,dir);
+          else
+              renderIndicator(p,r,fs,is,ds,ds.element+"-up-"+st,dir);
+        });
       }
       break;
     }
@@ -2375,12 +3298,18 @@ void QSvgThemableStyle::drawControl(ControlElement e, const QStyleOption * optio
         if ( opt->activeSubControls & SC_ScrollBarSlider )
           o.state = opt->state;
         st = state_str(o.state,widget);
-        renderFrame(p,bg,option->rect,fs,fs.element+"-"+st,dir,orn);
-        renderInterior(p,bg,option->rect,fs,is,is.element+"-"+st,dir,orn);
-        if ( focus ) {
-          renderFrame(p,QBrush(),option->rect,fs,fs.element+"-focused",dir,orn);
-          renderInterior(p,QBrush(),option->rect,fs,is,is.element+"-focused",dir,orn);
-        }
+        const QString bk = brushKey(bg);
+        renderComposite(p,
+                        bk.isEmpty() ? QString() :
+                          QString("sbslider:%1:%2:%3:%4:%5:%6").arg(g).arg(st).arg(focus).arg((int)orn).arg((int)dir).arg(bk),
+                        option->rect,[&](QPainter *p) {
+          renderFrame(p,bg,option->rect,fs,fs.element+"-"+st,dir,orn);
+          renderInterior(p,bg,option->rect,fs,is,is.element+"-"+st,dir,orn);
+          if ( focus ) {
+            renderFrame(p,QBrush(),option->rect,fs,fs.element+"-focused",dir,orn);
+            renderInterior(p,QBrush(),option->rect,fs,is,is.element+"-focused",dir,orn);
+          }
+        });
       }
       break;
     }
@@ -2635,10 +3564,9 @@ void QSvgThemableStyle::drawControl(ControlElement e, const QStyleOption * optio
         drawPrimitive(PE_PanelItemViewItem,opt,p,widget);
 
         QRect rlabel = subElementRect(SE_ItemViewItemText,opt,widget);
-        QRect rcheckmark = subElementRect(SE_ItemViewItemCheckIndicator,opt,widget);
 
         if ( opt->features & QStyleOptionViewItem::HasCheckIndicator ) {
-          o.rect = rcheckmark;
+          o.rect = subElementRect(SE_ItemViewItemCheckIndicator,opt,widget);
           if ( opt->checkState == Qt::PartiallyChecked )
             o.state |= State_NoChange;
           if ( opt->checkState == Qt::Checked )
@@ -2659,7 +3587,7 @@ void QSvgThemableStyle::drawControl(ControlElement e, const QStyleOption * optio
                     dir,rlabel,fs,is,ls,
                     opt->displayAlignment,
                     opt->text,
-                    opt->icon.pixmap(opt->decorationSize),
+                    opt->icon.isNull() ? QPixmap() : opt->icon.pixmap(opt->decorationSize),
                     tialign);
         p->restore();
       }
@@ -2728,13 +3656,33 @@ void QSvgThemableStyle::drawControl(ControlElement e, const QStyleOption * optio
   }
 
 end:
+  if ( trackChanges && isGuiThread() )
+    drawDepth--;
+  if ( isGuiThread() )
+    themeRndr->setPaintTarget(target);
   emit sig_drawControl_end(CE_str(e));
+
+  if ( quality == QualityFast )
+    p->setRenderHints(hints & (QPainter::Antialiasing | QPainter::SmoothPixmapTransform), true);
 }
 
 void QSvgThemableStyle::drawComplexControl(ComplexControl control, const QStyleOptionComplex * option, QPainter * p, const QWidget * widget) const
 {
   emit sig_drawComplexControl_begin(CC_str(control));
 
+  // repainted when the renderings it waits for are ready. Restored at
+  // the end: nested calls may paint other widgets
+  const QWidget *target = NULL;
+  if ( isGuiThread() ) {
+    target = themeRndr->currentPaintTarget();
+    themeRndr->setPaintTarget(widget);
+  }
+
+  // fast profile: no antialiasing nor smooth pixmap scaling
+  const QPainter::RenderHints hints = p->renderHints();
+  if ( quality == QualityFast )
+    p->setRenderHints(QPainter::Antialiasing | QPainter::SmoothPixmapTransform, false);
+
   // Copy some values into shorter variable names
   int x,y,w,h;
   QRect r = option->rect;
@@ -2748,6 +3696,13 @@ void QSvgThemableStyle::drawComplexControl(ComplexControl control, const QStyleO
   // Get QSvgStyle configuration group used to render this element
   QString g = CC_group(control);
 
+  // groups of the composites built by this call and the nested ones
+  if ( trackChanges && isGuiThread() ) {
+    if ( drawDepth++ == 0 )
+      drawGroups.clear();
+    drawGroups.insert(g);
+  }
+
   // Configuration for group g
   frame_spec_t fs;
   interior_spec_t is;
@@ -2763,6 +3718,9 @@ void QSvgThemableStyle::drawComplexControl(ComplexControl control, const QStyleO
     goto end;
   }
 
+  if ( trackChanges && widget && isGuiThread() )
+    changeTrackedUsers[widget].insert(g);
+
   // Get configuration for group
   fs = getFrameSpec(g);
   is = getInteriorSpec(g);
@@ -2801,16 +3759,57 @@ void QSvgThemableStyle::drawComplexControl(ComplexControl control, const QStyleO
         }
 
         // draw frame and interior
-        if ( option->state & State_AutoRaise ) {
-          // Auto raise buttons (found on toolbars)
-          if ( (option->state & State_Enabled) &&
-                ((option->state & State_Sunken) ||
-                (option->state & State_On) ||
-                (option->state & State_MouseOver))
-              ) {
-            // Draw frame and interior around normal non autoraise tool buttons
+        bool capsule = false;
+        int capsuleH = 0, capsuleV = 0;
+        if ( !(option->state & State_AutoRaise) )
+          computeButtonCapsule(widget,capsule,capsuleH,capsuleV);
+
+        const QString key = QString("toolbutton:%1:%2:%3:%4:%5:%6:%7")
+            .arg(g)
+            .arg((int)opt->features)
+            .arg((int)opt->activeSubControls)
+            .arg((int)dir)
+            .arg(capsule ? capsuleH*3+capsuleV : -10)
+            .arg(paletteKey(option))
+            .arg(QString("%1,%2,%3,%4")
+                 .arg(dropRect.x()-r.x()).arg(dropRect.y()-r.y())
+                 .arg(dropRect.width()).arg(dropRect.height()));
+
+        renderTransition(p,widget,key,r,option->state,[&](QPainter *p, State state) {
+          QStyleOptionToolButton o(*opt);
+
+          QStyle::State buttonState = state;
+          QStyle::State dropState = state;
+
+          if ( opt->features & QStyleOptionToolButton::Menu ) {
+            if ( !(opt->activeSubControls & QStyle::SC_ToolButton) )
+              buttonState &= ~(State_Sunken | State_MouseOver);
+            if ( !(opt->activeSubControls & QStyle::SC_ToolButtonMenu) )
+              dropState &= ~(State_On | State_Sunken | State_MouseOver);
+          }
+
+          if ( state & State_AutoRaise ) {
+            // Auto raise buttons (found on toolbars)
+            if ( (state & State_Enabled) &&
+                  ((state & State_Sunken) ||
+                  (state & State_On) ||
+                  (state & State_MouseOver))
+                ) {
+              // Draw frame and interior around normal non autoraise tool buttons
+              o.rect = r;
+              o.state = state;
+              drawPrimitive(PE_FrameButtonTool,&o,p,widget);
+              o.state = buttonState;
+              drawPrimitive(PE_PanelButtonTool,&o,p,widget);
+              if ( opt->features & QStyleOptionToolButton::Menu ) {
+                o.rect = dropRect;
+                o.state = dropState;
+                drawPrimitive(PE_PanelButtonTool,&o,p,widget);
+              }
+            }
+          } else {
             o.rect = r;
-            o.state = opt->state;
+            o.state = state;
             drawPrimitive(PE_FrameButtonTool,&o,p,widget);
             o.state = buttonState;
             drawPrimitive(PE_PanelButtonTool,&o,p,widget);
@@ -2820,18 +3819,7 @@ void QSvgThemableStyle::drawComplexControl(ComplexControl control, const QStyleO
               drawPrimitive(PE_PanelButtonTool,&o,p,widget);
             }
           }
-        } else {
-          o.rect = r;
-          o.state = opt->state;
-          drawPrimitive(PE_FrameButtonTool,&o,p,widget);
-          o.state = buttonState;
-          drawPrimitive(PE_PanelButtonTool,&o,p,widget);
-          if ( opt->features & QStyleOptionToolButton::Menu ) {
-            o.rect = dropRect;
-            o.state = dropState;
-            drawPrimitive(PE_PanelButtonTool,&o,p,widget);
-          }
-        }
+        });
 
         // Draw label
         o.rect = buttonRect;
@@ -2966,30 +3954,43 @@ void QSvgThemableStyle::drawComplexControl(ComplexControl control, const QStyleO
       if (opt) {
         QStyleOptionSlider o(*opt);
 
+        // Sub controls outside of the repainted region are skipped
+
         // Groove
         // Remove pressed and selected state for groove
         o.state &= ~(State_Sunken | State_Selected | State_On | State_MouseOver);
         st = state_str(o.state,widget);
         o.rect = subControlRect(CC_ScrollBar,opt,SC_ScrollBarGroove,widget);
-        renderFrame(p,bg,o.rect,fs,fs.element+"-"+st,dir,orn);
-        renderInterior(p,bg,o.rect,fs,is,is.element+"-"+st,dir,orn);
+        if ( isDirty(p,o.rect) ) {
+          const QString bk = brushKey(bg);
+          renderComposite(p,
+                          bk.isEmpty() ? QString() :
+                            QString("sbgroove:%1:%2:%3:%4:%5").arg(g).arg(st).arg((int)orn).arg((int)dir).arg(bk),
+                          o.rect,[&](QPainter *p) {
+            renderFrame(p,bg,o.rect,fs,fs.element+"-"+st,dir,orn);
+            renderInterior(p,bg,o.rect,fs,is,is.element+"-"+st,dir,orn);
+          });
+        }
 
         // Cursor
         o.state = opt->state;
         o.rect = subControlRect(CC_ScrollBar,opt,SC_ScrollBarSlider,widget);
-        drawControl(CE_ScrollBarSlider,&o,p,widget);
+        if ( isDirty(p,o.rect) )
+          drawControl(CE_ScrollBarSlider,&o,p,widget);
 
         // Buttons
         if ( getThemeTweak("specific.scrollbar.variant").toInt() == VA_SCROLLBAR_BUTTONS ) {
           // 'Next' arrow
           o.state = opt->state;
           o.rect = subControlRect(CC_ScrollBar,opt,SC_ScrollBarAddLine,widget);
-          drawControl(CE_ScrollBarAddLine,&o,p,widget);
+          if ( isDirty(p,o.rect) )
+            drawControl(CE_ScrollBarAddLine,&o,p,widget);
 
           // 'Previous' arrow
           o.state = opt->state;
           o.rect = subControlRect(CC_ScrollBar,opt,SC_ScrollBarSubLine,widget);
-          drawControl(CE_ScrollBarSubLine,&o,p,widget);
+          if ( isDirty(p,o.rect) )
+            drawControl(CE_ScrollBarSubLine,&o,p,widget);
         }
       }
 
@@ -3032,49 +4033,36 @@ void QSvgThemableStyle::drawComplexControl(ComplexControl control, const QStyleO
             }
           }
 
-          // draw empty part
-          fs.hasCapsule = true;
-          if (opt->orientation == Qt::Horizontal)
-            fs.capsuleV = 2;
-          else
-            fs.capsuleH = 2;
+          // The empty and elapsed parts are each rendered once over
+          // the whole groove, then blitted clipped to their part: moving
+          // the slider does not render the groove again
+          fs.hasCapsule = false;
 
-          if (opt->orientation == Qt::Horizontal) {
-            if (!opt->upsideDown) {
-              fs.capsuleH = 1;
-            } else {
-              fs.capsuleH = -1;
-            }
-          } else {
-            if (!opt->upsideDown) {
-              fs.capsuleV = 1;
-            } else {
-              fs.capsuleV = -1;
-            }
-          }
+          const QString bk = brushKey(bg);
+          const QString key = bk.isEmpty() ? QString() :
+            QString("slidergroove:%1:%2:%3:%4:%5").arg(g).arg(st).arg((int)orn).arg((int)dir).arg(bk);
 
-          // FIXME should we clip the rect instead ?
-          renderFrame(p,bg,empty,fs,fs.element+"-"+st,dir,orn);
-          renderInterior(p,bg,empty,fs,is,is.element+"-"+st,dir,orn);
+          // draw empty part
+          if ( isDirty(p,empty) ) {
+            p->save();
+            p->setClipRect(empty,Qt::IntersectClip);
+            renderComposite(p,key.isEmpty() ? key : key+":empty",groove,[&](QPainter *p) {
+              renderFrame(p,bg,groove,fs,fs.element+"-"+st,dir,orn);
+              renderInterior(p,bg,groove,fs,is,is.element+"-"+st,dir,orn);
+            });
+            p->restore();
+          }
 
           // draw elapsed part
-          if (option->state & State_Horizontal) {
-            if (!opt->upsideDown) {
-              fs.capsuleH = -1;
-            } else {
-              fs.capsuleH = 1;
-            }
-          } else {
-            if (!opt->upsideDown) {
-              fs.capsuleV = -1;
-            } else {
-              fs.capsuleV = 1;
-            }
+          if ( isDirty(p,full) ) {
+            p->save();
+            p->setClipRect(full,Qt::IntersectClip);
+            renderComposite(p,key.isEmpty() ? key : key+":elapsed",groove,[&](QPainter *p) {
+              renderFrame(p,bg,groove,fs,fs.element+"-elapsed-"+st,dir,orn);
+              renderInterior(p,bg,groove,fs,is,is.element+"-elapsed-"+st,dir,orn);
+            });
+            p->restore();
           }
-
-          // FIXME should we clip the rect instead ?
-          renderFrame(p,bg,full,fs,fs.element+"-elapsed-"+st,dir,orn);
-          renderInterior(p,bg,full,fs,is,is.element+"-elapsed-"+st,dir,orn);
         }
 
         // ticks
@@ -3097,42 +4085,57 @@ void QSvgThemableStyle::drawComplexControl(ComplexControl control, const QStyleO
           int tickOffset = pixelMetric(PM_SliderTickmarkOffset, opt, widget);
           int tickPos = opt->tickPosition;
 
-          int val = opt->minimum;
-          int pos;
-          while ( val <= opt->maximum+1 ) {
-            pos = sliderPositionFromValue(opt->minimum,opt->maximum,
-                                          val, range);
-
-            if ( orn == Horizontal ) {
-              if ( tickPos & QSlider::TicksBelow ) {
-                renderElement(p,ds.element+"-htick-"+st,
-                              QRect(groove.x()+pos,groove.y()+groove.height()+tickOffset,
-                                    1,3)
-                              );
-              }
-              if ( tickPos & QSlider::TicksAbove ) {
-                renderElement(p,ds.element+"-htick-"+st,
-                              QRect(groove.x()+pos,groove.y()-tickOffset-3,
-                                    1,3)
-                              );
-              }
-            } else {
-              if ( tickPos & QSlider::TicksRight ) {
-                renderElement(p,ds.element+"-vtick-"+st,
-                              QRect(groove.x()+groove.width()+tickOffset,groove.y()+pos,
-                                    3,1)
-                              );
-              }
-              if ( tickPos & QSlider::TicksLeft ) {
-                renderElement(p,ds.element+"-vtick-"+st,
-                              QRect(groove.x()-tickOffset-3,groove.y()+pos,
-                                    3,1)
-                              );
+          // ticks only change with the range and the geometry
+          const QString key = QString("ticks:%1:%2:%3:%4:%5:%6:%7:%8:%9")
+              .arg(g+"/"+st)
+              .arg(opt->minimum)
+              .arg(opt->maximum)
+              .arg(interval)
+              .arg(tickPos)
+              .arg(tickOffset)
+              .arg((int)orn)
+              .arg(QString("%1,%2,%3,%4").arg(groove.x()-r.x()).arg(groove.y()-r.y())
+                   .arg(groove.width()).arg(groove.height()))
+              .arg(range);
+
+          renderComposite(p,key,r,[&](QPainter *p) {
+            int val = opt->minimum;
+            int pos;
+            while ( val <= opt->maximum+1 ) {
+              pos = sliderPositionFromValue(opt->minimum,opt->maximum,
+                                            val, range);
+
+              if ( orn == Horizontal ) {
+                if ( tickPos & QSlider::TicksBelow ) {
+                  renderElement(p,ds.element+"-htick-"+st,
+                                QRect(groove.x()+pos,groove.y()+groove.height()+tickOffset,
+                                      1,3)
+                                );
+                }
+                if ( tickPos & QSlider::TicksAbove ) {
+                  renderElement(p,ds.element+"-htick-"+st,
+                                QRect(groove.x()+pos,groove.y()-tickOffset-3,
+                                      1,3)
+                                );
+                }
+              } else {
+                if ( tickPos & QSlider::TicksRight ) {
+                  renderElement(p,ds.element+"-vtick-"+st,
+                                QRect(groove.x()+groove.width()+tickOffset,groove.y()+pos,
+                                      3,1)
+                                );
+                }
+                if ( tickPos & QSlider::TicksLeft ) {
+                  renderElement(p,ds.element+"-vtick-"+st,
+                                QRect(groove.x()-tickOffset-3,groove.y()+pos,
+                                      3,1)
+                                );
+                }
               }
-            }
 
-            val += interval;
-          }
+              val += interval;
+            }
+          });
         }
 
         // cursor
@@ -3169,36 +4172,44 @@ void QSvgThemableStyle::drawComplexControl(ComplexControl control, const QStyleO
 
         QRect groove = squaredRect(subControlRect(CC_Dial,opt,SC_DialGroove,widget));
         o.rect = groove;
-        renderInterior(p,bg,o.rect,fs,is,is.element+"-"+st,dir,orn);
 
         // TODO make configurable
         int startAngle = -60;
         int endAngle = 230;
 
-        // tick marks
-        if ( opt->subControls & QStyle::SC_DialTickmarks ) {
-          o.state &= ~(State_MouseOver | State_Sunken);
-          st = state_str(o.state,widget);
-
-          // clip tickmarks in the startAngle..endAngle pie
-//           QPainterPath clip;
-//           clip.addPolygon(QPolygonF()
-//             << groove.center()
-//             << QPointF(x,y+h/2+qAbs(qSin(qDegreesToRadians(startAngle)))*w/2)
-//             << QPointF(x,y)
-//             << QPointF(x+w-1,y)
-//             << QPointF(x+w-1,y+h/2+qAbs(qSin(qDegreesToRadians(endAngle)))*w/2)
-//             << groove.center()
-//           );
-//           qDebug() << "sin start" << qSin(qDegreesToRadians(startAngle));
-//           qDebug() << "sin end" << qSin(qDegreesToRadians(endAngle));
-//           qDebug() << clip;
-//           p->drawPath(clip);
-//           p->save();
-//           p->setClipPath(clip);
-          renderInterior(p,bg,o.rect,fs,is,is.element+"-ticks-"+st,dir,orn);
-//           p->restore();
-        }
+        const QString bk = brushKey(bg);
+        const bool ticks = opt->subControls & QStyle::SC_DialTickmarks;
+
+        // groove and tick marks only change with the state
+        QStyleOptionSlider t(*opt);
+        t.state &= ~(State_MouseOver | State_Sunken);
+        const QString tst = state_str(t.state,widget);
+
+        renderComposite(p,
+                        bk.isEmpty() ? QString() :
+                          QString("dial:%1:%2:%3:%4:%5").arg(g).arg(st).arg(ticks ? tst : QString())
+                          .arg((int)dir).arg(bk),
+                        groove,[&](QPainter *p) {
+          renderInterior(p,bg,groove,fs,is,is.element+"-"+st,dir,orn);
+
+          // tick marks
+          if ( ticks ) {
+            // clip tickmarks in the startAngle..endAngle pie
+//             QPainterPath clip;
+//             clip.addPolygon(QPolygonF()
+//               << groove.center()
+//               << QPointF(x,y+h/2+qAbs(qSin(qDegreesToRadians(startAngle)))*w/2)
+//               << QPointF(x,y)
+//               << QPointF(x+w-1,y)
+//               << QPointF(x+w-1,y+h/2+qAbs(qSin(qDegreesToRadians(endAngle)))*w/2)
+//               << groove.center()
+//             );
+//             p->save();
+//             p->setClipPath(clip);
+            renderInterior(p,bg,groove,fs,is,is.element+"-ticks-"+tst,dir,orn);
+//             p->restore();
+          }
+        });
 
         // handle
         const int range = endAngle-startAngle;
@@ -3211,16 +4222,27 @@ void QSvgThemableStyle::drawComplexControl(ComplexControl control, const QStyleO
          else
            angle = 180-(startAngle+pos);  // we want CCW rotations in RTL
 
-        o.rect = QRect(-groove.width()/2,-groove.height()/2,
-                       groove.width(),groove.height());
         o.state = opt->state;
         st = state_str(o.state,widget);
 
-        p->save();
-        p->translate(QPoint(groove.center().x(),groove.center().y()));
-        p->rotate(angle);
-        renderInterior(p,bg,o.rect,fs,is,is.element+"-handle-"+st,dir,orn);
-        p->restore();
+        // The handle is cached pre-rotated at quantized angles, so that
+        // turning the dial only blits
+        if ( dialAngleStep > 0 )
+          angle = qRound(angle/dialAngleStep)*dialAngleStep;
+
+        renderComposite(p,
+                        (bk.isEmpty() || (dialAngleStep <= 0)) ? QString() :
+                          QString("dialhandle:%1:%2:%3:%4:%5").arg(g).arg(st).arg(angle)
+                          .arg((int)dir).arg(bk),
+                        groove,[&](QPainter *p) {
+          p->save();
+          p->translate(QPoint(groove.center().x(),groove.center().y()));
+          p->rotate(angle);
+          renderInterior(p,bg,QRect(-groove.width()/2,-groove.height()/2,
+                                    groove.width(),groove.height()),
+                         fs,is,is.element+"-handle-"+st,dir,orn);
+          p->restore();
+        });
       }
 
       break;
@@ -3387,7 +4409,14 @@ void QSvgThemableStyle::drawComplexControl(ComplexControl control, const QStyleO
   }
 
 end:
+  if ( trackChanges && isGuiThread() )
+    drawDepth--;
+  if ( isGuiThread() )
+    themeRndr->setPaintTarget(target);
   emit sig_drawComplexControl_end(CC_str(control));
+
+  if ( quality == QualityFast )
+    p->setRenderHints(hints & (QPainter::Antialiasing | QPainter::SmoothPixmapTransform), true);
 }
 
 int QSvgThemableStyle::pixelMetric(PixelMetric metric, const QStyleOption * option, const QWidget * widget) const
@@ -5166,7 +6195,13 @@ QIcon QSvgThemableStyle::standardIcon(StandardPixmap standardIcon, const QStyleO
     // default QCommonStyle icon
     return icon;
 
-  // build icon
+  // build icon. Icons are never repainted, they must not get placeholders
+  const QWidget *target = NULL;
+  if ( isGuiThread() ) {
+    target = themeRndr->currentPaintTarget();
+    themeRndr->setPaintTarget(NULL);
+  }
+
   QRect r(0,0,sz,sz);
   QPainter p;
 
@@ -5205,6 +6240,9 @@ QIcon QSvgThemableStyle::standardIcon(StandardPixmap standardIcon, const QStyleO
   p.end();
   icon.addPixmap(pm_toggled,QIcon::Selected,QIcon::On);
 
+  if ( isGuiThread() )
+    themeRndr->setPaintTarget(target);
+
   return icon;
 }
 
@@ -5234,6 +6272,10 @@ void QSvgThemableStyle::renderElement(QPainter* p, const QString& element, const
     return;
   }
 
+  // composites are only built on the GUI thread
+  if ( trackChanges && isGuiThread() && (compositeDepth > 0) )
+    compositeElements.insert(element);
+
   if (themeRndr) {
     if ( (hsize > 0) || (vsize > 0) ) {
 
@@ -5376,6 +6418,213 @@ void QSvgThemableStyle::computeFrameRects(const QRect& bounds,
   }
 }
 
+void QSvgThemableStyle::renderComposite(QPainter *p,
+                                        const QString &key,
+                                        const QRect &bounds,
+                                        const std::function<void (QPainter *)> &render) const
+{
+  if ( !bounds.isValid() )
+    return;
+
+  const QPixmap px = compositePixmap(p,key,bounds,render);
+
+  if ( px.isNull() )
+    render(p);
+  else
+    p->drawPixmap(bounds.topLeft(),px);
+}
+
+QPixmap QSvgThemableStyle::compositePixmap(QPainter *p,
+                                           const QString &key,
+                                           const QRect &bounds,
+                                           const std::function<void (QPainter *)> &render) const
+{
+  // Composites are not cached if the config can change behind our back,
+  // or if the painter would scale or rotate the cached pixmap
+  // Nested composites are part of the outer one, do not cache them twice
+  // Vector devices (PDF, printers) get vector output, not pixmaps
+  // Worker threads can not use pixmaps, they render directly
+  if ( key.isEmpty() || !bounds.isValid() || !useShapeCache || !useConfigCache ||
+       !useCompositeCache || !isGuiThread() || (compositeDepth > 0) ||
+       (p->transform().type() > QTransform::TxTranslate) ||
+       QSvgCachedRenderer::isVectorDevice(p) ) {
+    return QPixmap();
+  }
+
+  const qreal dpr = p->device() ? p->device()->devicePixelRatioF() : 1.0;
+
+  // key = key @ width x height @ dpr
+  const QString k = QString("%1@%2x%3@%4")
+      .arg(key)
+      .arg(bounds.width())
+      .arg(bounds.height())
+      .arg(dpr);
+
+  if ( QPixmap *px = compositeCache.object(k) )
+    return *px;
+
+  QPixmap *px = new QPixmap(bounds.size()*dpr);
+  px->setDevicePixelRatio(dpr);
+  px->fill(Qt::transparent);
+
+  const quint32 placeholders = themeRndr->placeholderCount();
+
+  {
+    QPainter pp(px);
+    pp.setRenderHints(p->renderHints());
+    pp.translate(-bounds.topLeft());
+    if ( trackChanges && (compositeDepth == 0) )
+      compositeElements.clear();
+    compositeDepth++;
+    render(&pp);
+    compositeDepth--;
+  }
+
+  // the cache may delete it right away if it is too big
+  const QPixmap r = *px;
+
+  // do not keep placeholders nor stretched resize renderings, the
+  // composite is rendered again on the repaint that follows the exact
+  // renderings
+  if ( themeRndr->placeholderCount() != placeholders ) {
+    delete px;
+    return r;
+  }
+
+  // cost is in KB
+  compositeCache.insert(k,px,qMax(1,px->width()*px->height()*px->depth()/8/1024));
+
+  if ( trackChanges ) {
+    composite_deps_t deps;
+    deps.groups = drawGroups;
+    deps.elements = compositeElements;
+    compositeDeps.insert(k,deps);
+  }
+
+  return r;
+}
+
+void QSvgThemableStyle::renderTransition(QPainter *p,
+                                         const QWidget *widget,
+                                         const QString &key,
+                                         const QRect &bounds,
+                                         State state,
+                                         const std::function<void (QPainter *, State)> &render) const
+{
+  // only hover and press changes are animated
+  const State mask = State_MouseOver | State_Sunken | State_On;
+
+  QString k = key.isEmpty() ? QString() :
+    QString("%1:%2").arg(key).arg((uint)state);
+
+  if ( !widget || !transitionsEnabled || key.isEmpty() ||
+       QSvgCachedRenderer::isVectorDevice(p) || !isGuiThread() ) {
+    renderComposite(p,k,bounds,[&](QPainter *p) { render(p,state); });
+    return;
+  }
+
+  QWidget *w = (QWidget *)widget;
+
+  QHash<const QWidget *,transition_t>::iterator it = transitions.find(widget);
+  if ( it == transitions.end() ) {
+    // first paint: nothing to transition from
+    transition_t t;
+    t.from = t.to = state;
+    transitions.insert(widget,t);
+    // widgets are not all filtered, forget them when they go away so
+    // that a new widget at the same address does not inherit the entry
+    connect(w,&QObject::destroyed,
+            const_cast<QSvgThemableStyle *>(this),
+            &QSvgThemableStyle::slot_transitionWidgetDestroyed,
+            Qt::UniqueConnection);
+    renderComposite(p,k,bounds,[&](QPainter *p) { render(p,state); });
+    return;
+  }
+
+  transition_t &t = it.value();
+
+  if ( (t.to & mask) != (state & mask) ) {
+    t.from = t.to;
+    animations->stop(w, QSvgAnimationScheduler::StateTransition);
+    animations->start(w, QSvgAnimationScheduler::StateTransition, transitionStep);
+    animations->setUpdateRect(w, QSvgAnimationScheduler::StateTransition, bounds);
+  }
+  t.to = state;
+
+  const qint64 elapsed =
+    animations->elapsed(w, QSvgAnimationScheduler::StateTransition);
+
+  if ( !animations->isRunning(w, QSvgAnimationScheduler::StateTransition) ||
+       (elapsed >= transitionDuration) ) {
+    animations->stop(w, QSvgAnimationScheduler::StateTransition);
+    renderComposite(p,k,bounds,[&](QPainter *p) { render(p,state); });
+    return;
+  }
+
+  // cross-fade between the two cached composites
+  const State from = t.from;
+  const QPixmap fromPx =
+    compositePixmap(p,QString("%1:%2").arg(key).arg((uint)from),bounds,
+                    [&](QPainter *p) { render(p,from); });
+  const QPixmap toPx =
+    compositePixmap(p,k,bounds,[&](QPainter *p) { render(p,state); });
+
+  if ( fromPx.isNull() || toPx.isNull() ) {
+    render(p,state);
+    return;
+  }
+
+  const qreal progress = (qreal)elapsed/transitionDuration;
+  const qreal opacity = p->opacity();
+
+  p->save();
+  p->setOpacity(opacity*(1-progress));
+  p->drawPixmap(bounds.topLeft(),fromPx);
+  p->setOpacity(opacity*progress);
+  p->drawPixmap(bounds.topLeft(),toPx);
+  p->restore();
+}
+
+bool QSvgThemableStyle::isDirty(QPainter *p, const QRect &r) const
+{
+  // the system clip holds the region being repainted, in device
+  // coordinates
+  const QPaintEngine *e = p->paintEngine();
+  if ( !e )
+    return true;
+
+  const QRegion dirty = e->systemClip();
+  if ( dirty.isEmpty() )
+    return true;
+
+  return dirty.intersects(p->deviceTransform().mapRect(r));
+}
+
+QString QSvgThemableStyle::paletteKey(const QStyleOption *opt) const
+{
+  // bgBrush() also depends on the background role of the widget
+  int role = -1;
+  if ( const QWidget *w = qobject_cast<const QWidget *>(opt->styleObject) )
+    role = w->backgroundRole();
+
+  return QString("%1/%2").arg(opt->palette.cacheKey()).arg(role);
+}
+
+QString QSvgThemableStyle::brushKey(const QBrush &b) const
+{
+  switch ( b.style() ) {
+    case Qt::NoBrush:
+      return "none";
+    case Qt::SolidPattern:
+      return QString::number(b.color().rgba(),16);
+    case Qt::TexturePattern:
+      return QString("t%1").arg(b.texture().cacheKey());
+    default:
+      // gradients and patterns: not worth it
+      return QString();
+  }
+}
+
 void QSvgThemableStyle::renderFrame(QPainter *p,
                     /* color spec */ const QBrush &b,
                     /* frame bounds */ const QRect &bounds,
@@ -5536,24 +6785,32 @@ void QSvgThemableStyle::renderFrame(QPainter *p,
     darkBrush.setColor(darkColor);
 
     if ( !dbgWireframe && (curPalette != "<none>") ) {
-      region += themeRndr->elementRegion(e+"-top", top);
-      region += themeRndr->elementRegion(e+"-bottom", bottom);
-      region += themeRndr->elementRegion(e+"-left", left);
-      region += themeRndr->elementRegion(e+"-right", right);
-      region += themeRndr->elementRegion(e+"-topleft", topleft);
-      region += themeRndr->elementRegion(e+"-topright", topright);
-      region += themeRndr->elementRegion(e+"-bottomleft", bottomleft);
-      region += themeRndr->elementRegion(e+"-bottomright", bottomright);
+      const qreal scale = QSvgCachedRenderer::renderScale(p);
+      region += themeRndr->elementRegion(e+"-top", top, scale);
+      region += themeRndr->elementRegion(e+"-bottom", bottom, scale);
+      region += themeRndr->elementRegion(e+"-left", left, scale);
+      region += themeRndr->elementRegion(e+"-right", right, scale);
+      region += themeRndr->elementRegion(e+"-topleft", topleft, scale);
+      region += themeRndr->elementRegion(e+"-topright", topright, scale);
+      region += themeRndr->elementRegion(e+"-bottomleft", bottomleft, scale);
+      region += themeRndr->elementRegion(e+"-bottomright", bottomright, scale);
 
       p->save();
       p->setClipRegion(region, Qt::IntersectClip);
 
-      if ( !fs.pressed ) {
-        p->fillPath(lightPath,lightColor);
-        p->fillPath(darkPath,darkColor);
+      if ( use3dFrame && (quality == QualityHigh) ) {
+        if ( !fs.pressed ) {
+          p->fillPath(lightPath,lightColor);
+          p->fillPath(darkPath,darkColor);
+        } else {
+          p->fillPath(lightPath,darkColor);
+          p->fillPath(darkPath,lightColor);
+        }
       } else {
-        p->fillPath(lightPath,darkColor);
-        p->fillPath(darkPath,lightColor);
+        // flat colorization: a single fill clipped to the frame
+        QColor c = b.color();
+        c.setAlpha(intensity);
+        p->fillRect(bounds,c);
       }
 
       p->restore();
@@ -5696,7 +6953,7 @@ void QSvgThemableStyle::renderInterior(QPainter *p,
 
     if ( !dbgWireframe && (curPalette != "<none>") ) {
       p->save();
-      QRegion region = themeRndr->elementRegion(e, r);
+      QRegion region = themeRndr->elementRegion(e, r, QSvgCachedRenderer::renderScale(p));
       //qWarning() << "Region for" << e << "is" << region;
       p->setClipRegion(region, Qt::IntersectClip);
       p->fillRect(r,interiorColor);
@@ -5840,8 +7097,15 @@ void QSvgThemableStyle::colorizeIndicator(QPainter *p,
   }
 
   // Colorize
-  p->fillPath(darkPath,darkColor);
-  p->fillPath(lightPath,lightColor);
+  if ( use3dFrame && (quality == QualityHigh) ) {
+    p->fillPath(darkPath,darkColor);
+    p->fillPath(lightPath,lightColor);
+  } else {
+    // flat colorization: a single fill
+    QColor c = b.color();
+    c.setAlpha(intensity);
+    p->fillRect(r,c);
+  }
 
   if ( dir == Qt::RightToLeft ) {
     p->restore();
@@ -5938,34 +7202,65 @@ void QSvgThemableStyle::renderLabel(QPainter* p,
   emit sig_renderLabel_end("text:"+text+"/icon:"+(pixmap.isNull() ? "yes":"no"));
 }
 
+inline bool QSvgThemableStyle::isGuiThread() const
+{
+  return QThread::currentThread() == thread();
+}
+
+const element_spec_t &QSvgThemableStyle::getElementSpec(const QString& group) const
+{
+  if ( trackChanges )
+    drawGroups.insert(group);
+
+  QHash<QString,element_spec_t>::const_iterator it = specCache.constFind(group);
+  if ( it != specCache.constEnd() )
+    return it.value();
+
+  return specCache.insert(group,themeSettings->getElementSpec(group)).value();
+}
+
 inline frame_spec_t QSvgThemableStyle::getFrameSpec(const QString& group) const
 {
-  return themeSettings->getFrameSpec(group);
+  // specs can not be cached while they are being edited. The cache
+  // belongs to the GUI thread
+  if ( !useConfigCache || !isGuiThread() )
+    return themeSettings->getFrameSpec(group);
+  return getElementSpec(group).frame;
 }
 
 inline interior_spec_t QSvgThemableStyle::getInteriorSpec(const QString& group) const
 {
-  return themeSettings->getInteriorSpec(group);
+  if ( !useConfigCache || !isGuiThread() )
+    return themeSettings->getInteriorSpec(group);
+  return getElementSpec(group).interior;
 }
 
 inline indicator_spec_t QSvgThemableStyle::getIndicatorSpec(const QString& group) const
 {
-  return themeSettings->getIndicatorSpec(group);
+  if ( !useConfigCache || !isGuiThread() )
+    return themeSettings->getIndicatorSpec(group);
+  return getElementSpec(group).indicator;
 }
 
 inline label_spec_t QSvgThemableStyle::getLabelSpec(const QString& group) const
 {
-  return themeSettings->getLabelSpec(group);
+  if ( !useConfigCache || !isGuiThread() )
+    return themeSettings->getLabelSpec(group);
+  return getElementSpec(group).label;
 }
 
 inline palette_spec_t QSvgThemableStyle::getPaletteSpec(const QString& group) const
 {
-  return themeSettings->getPaletteSpec(group);
+  if ( !useConfigCache || !isGuiThread() )
+    return themeSettings->getPaletteSpec(group);
+  return getElementSpec(group).palette;
 }
 
 inline font_spec_t QSvgThemableStyle::getFontSpec(const QString& group) const
 {
-  return themeSettings->getFontSpec(group);
+  if ( !useConfigCache || !isGuiThread() )
+    return themeSettings->getFontSpec(group);
+  return getElementSpec(group).font;
 }
 
 inline QVariant QSvgThemableStyle::getThemeTweak(const QString &key) const
@@ -22,22 +22,35 @@
 
 #include <QCommonStyle>
 #include <QString>
+#include <QStringList>
+#include <QHash>
+#include <QSet>
+#include <QCache>
+#include <QPixmap>
+#include <QPointer>
+
+#include <functional>
 
 #include "specs.h"
 
 class QWidget;
 class QSvgRenderer;
 class QSettings;
+class QScreen;
 class QVariant;
 class QFont;
 class QTimer;
+class QFileSystemWatcher;
 class QLayout;
+class QMenu;
+class QComboBox;
 template<typename T> class QList;
 template<typename T1, typename T2> class QMap;
 
 class ThemeConfig;
 class StyleConfig;
 class QSvgCachedRenderer;
+class QSvgAnimationScheduler;
 
 class QSvgThemableStyle : public QCommonStyle {
   Q_OBJECT
@@ -111,6 +124,74 @@ class QSvgThemableStyle : public QCommonStyle {
     Q_INVOKABLE void setUseConfigCache(bool val);
     /* Use SVG cache ? */
     Q_INVOKABLE void setUseShapeCache(bool val);
+    /* Use composite cache ? Used by benchmarks to measure its gain */
+    Q_INVOKABLE void setUseCompositeCache(bool val);
+    /* Theme development: reload theme files when they change on disk.
+     * Also enabled by setting QSVGSTYLE_HOTRELOAD=1 */
+    Q_INVOKABLE void setHotReload(bool val);
+    /* Reloads changed theme files, only repainting affected widgets */
+    Q_INVOKABLE void reloadChangedFiles();
+    /* Paint area counter: counts the pixels repainted by widgets.
+     * Also enabled by setting QSVGSTYLE_PAINTSTATS=1, in which case the
+     * total is printed when the style is destroyed */
+    Q_INVOKABLE void setCountPaintedArea(bool val);
+    Q_INVOKABLE quint64 paintedArea() const { return paintArea; }
+
+    /* Watches the files of the current theme if hot reload is enabled */
+    void updateHotReloadWatcher();
+
+    /**
+     * Returns whether widgets rendered with the given group must be
+     * repainted after the given config groups and SVG elements changed
+     */
+    bool isGroupAffected(const QString &group,
+                         const QStringList &groups,
+                         const QStringList &elements) const;
+
+    /**
+     * Returns whether the caller runs in the GUI thread. Styled widgets
+     * may also be rendered into QImages from worker threads, which
+     * bypass pixmap caches, animations and the spec cache
+     */
+    bool isGuiThread() const;
+
+    /* Clears the composite and spec caches, e.g. when the theme changes */
+    void invalidateCaches();
+
+    /* Clears the cached composites and specs built from the given changed
+     * config groups and SVG elements */
+    void invalidateCaches(const QStringList &groups, const QStringList &elements);
+
+    /* Reads engine settings (cache sizes, transitions) from the style tweaks */
+    void setupEngineTweaks();
+
+    /**
+     * Queues the pre-rendering of the popup elements (menus, combo
+     * popups and tooltips) used by the given widget. The queue is
+     * processed from a low priority timer once the first window has
+     * been painted, one widget at a time, so that the first popup
+     * opens from warm caches without delaying startup
+     */
+    void schedulePrewarm(QWidget *widget);
+
+    /**
+     * Renders the elements of the given menu into a scratch pixmap,
+     * filling the caches. The size is the one the menu will have when
+     * it already has actions, a typical one otherwise
+     */
+    void prewarmMenu(const QMenu *menu);
+
+    /**
+     * Renders the popup list elements of the given combo box into a
+     * scratch pixmap, at the size of its items and of its popup
+     */
+    void prewarmComboPopup(const QComboBox *combo);
+
+    /**
+     * Renders the tooltip elements into a scratch pixmap for the
+     * screen of the given window, filling the caches
+     */
+    void prewarmToolTip(const QWidget *window);
 
     /* Loads user config in ~/.config/QSvgStyle/qsvgstyle.cfg */
     void loadUserConfig();
@@ -193,6 +274,29 @@ class QSvgThemableStyle : public QCommonStyle {
      */
     bool isAnimatableWidget(const QWidget * widget) const;
 
+    /**
+     * Returns whether the given widget is a complex control whose hover
+     * rendering is limited to its hovered sub control, so that entering
+     * and leaving it need not repaint the whole widget
+     */
+    bool isSubControlHoverWidget(const QWidget * widget) const;
+
+    /**
+     * Computes the part of the given widget that must be repainted when
+     * the mouse enters or leaves it, besides the hovered sub control
+     * that the widget updates itself. Returns false if the whole widget
+     * must be repainted
+     */
+    bool hoverUpdateRegion(const QWidget * widget, QRegion &region) const;
+
+    /**
+     * Returns whether the frame and interior of the given group, in all
+     * the given states, fully cover their bounds with opaque pixels.
+     * Widgets only painted with such groups need no translucency nor
+     * parent background
+     */
+    bool isGroupOpaque(const QString &group, const QStringList &states) const;
+
     /**
      * Core QSvgStyle drawing routine
      *
@@ -207,6 +311,64 @@ class QSvgThemableStyle : public QCommonStyle {
                        int hsize = 0,
                        int vsize = 0) const;
 
+    /**
+     * Draws a composite (e.g. a frame, its interior and indicator) inside
+     * the given bounds. On a cache miss, @ref render is called to paint
+     * the composite at its position into a cached pixmap, which is then
+     * blitted. The key must identify everything @ref render depends on,
+     * but the size. An empty key disables caching.
+     */
+    void renderComposite(QPainter *p,
+                         const QString &key,
+                         const QRect &bounds,
+                         const std::function<void (QPainter *)> &render) const;
+
+    /**
+     * Returns the pixmap of the given composite, rendering and caching
+     * it on a miss. Returns a null pixmap if the composite can not
+     * be cached
+     */
+    QPixmap compositePixmap(QPainter *p,
+                            const QString &key,
+                            const QRect &bounds,
+                            const std::function<void (QPainter *)> &render) const;
+
+    /**
+     * Same as @ref renderComposite for a composite that depends on the
+     * widget state. When the hover or press state of the widget changes,
+     * the composites of the old and the new states are cross-faded
+     * on the animation clock. @ref render paints the composite for the
+     * given state
+     */
+    void renderTransition(QPainter *p,
+                          const QWidget *widget,
+                          const QString &key,
+                          const QRect &bounds,
+                          State state,
+                          const std::function<void (QPainter *, State)> &render) const;
+
+    /**
+     * Returns whether the given rect intersects the region being repainted
+     */
+    bool isDirty(QPainter *p, const QRect &r) const;
+
+    /**
+     * Returns a string identifying the palette and background role
+     * used by the given option, for composite keys
+     */
+    QString paletteKey(const QStyleOption *opt) const;
+
+    /**
+     * Returns a string identifying the given brush for composite keys,
+     * or an empty string if the brush is not worth caching
+     */
+    QString brushKey(const QBrush &b) const;
+
+    /**
+     * Returns the resolved specs of the given group. They are cached
+     * until the theme changes
+     */
+    const element_spec_t &getElementSpec(const QString &group) const;
     /**
      * Returns the frame spec of the given group
      */
@@ -478,9 +640,27 @@ class QSvgThemableStyle : public QCommonStyle {
 
   private slots:
     /**
-     * Slot called on timer timeout to animate busy progress bars
+     * Slot called when a theme file changes on disk while hot reload
+     * is enabled
+     */
+    void slot_hotReloadFileChanged(const QString &filename);
+
+    /**
+     * Slot called when a screen goes away: drops the renderings made
+     * for its device pixel ratio if no other screen uses it
+     */
+    void slot_screenRemoved(QScreen *screen);
+
+    /**
+     * Slot called when a widget having a state transition is destroyed
      */
-    void slot_animateProgressBars();
+    void slot_transitionWidgetDestroyed(QObject *o);
+
+    /**
+     * Slot called by the prewarm timer: pre-renders the popups of the
+     * next queued widget
+     */
+    void slot_prewarmNext();
 
   private:
     // Helper for computing an effective tab rect
@@ -497,18 +677,93 @@ class QSvgThemableStyle : public QCommonStyle {
     /* shape cache */
     bool useShapeCache;
 
+    /* composite cache, cost in KB */
+    bool useCompositeCache;
+    mutable QCache<QString,QPixmap> compositeCache;
+
+    /* groups and SVG elements each composite was built from, recorded
+     * while tracking changes so that reloads only drop what changed */
+    typedef struct {
+      QSet<QString> groups, elements;
+    } composite_deps_t;
+    mutable QHash<QString,composite_deps_t> compositeDeps;
+    /* groups used by the current outermost draw call */
+    mutable QSet<QString> drawGroups;
+    mutable int drawDepth;
+    /* elements rendered by the current outermost composite */
+    mutable QSet<QString> compositeElements;
+
+    /* rendering quality profile, trades fidelity for paint throughput */
+    enum Quality {
+      QualityHigh,
+      /* flat colorization, slower animations */
+      QualityBalanced,
+      /* flat colorization, no antialiasing, no translucency,
+       * no transitions, slowest animations */
+      QualityFast
+    };
+    Quality quality;
+
+    /* dial handles are cached pre-rotated every dialAngleStep degrees */
+    int dialAngleStep;
+
+    /* cache misses draw a placeholder and render in the background */
+    bool asyncMisses;
+
+    /* record the elements drawn and pre-render them at next start */
+    bool usageProfile;
+
+    /* minutes after which unused element renderings are compressed */
+    int coldDelay;
+
+    /* resolved specs, by group */
+    mutable QHash<QString,element_spec_t> specCache;
+
+    /* opacity of groups, by group and states */
+    mutable QHash<QString,bool> opacityCache;
+
+    /* state transitions */
+    typedef struct {
+      State from, to;
+    } transition_t;
+
+    bool transitionsEnabled;
+    int transitionDuration, transitionStep;
+    mutable QHash<const QWidget *,transition_t> transitions;
+
+    /* > 0 while rendering a composite */
+    mutable int compositeDepth;
+
+    /* popups already pre-rendered, by font, palette, size and pixel ratio */
+    QSet<QString> prewarmed;
+    /* widgets whose popups wait to be pre-rendered */
+    QList< QPointer<QWidget> > prewarmQueue;
+    QTimer *prewarmTimer;
+    /* true once a window has been painted: startup is over */
+    bool windowPainted;
+
+    /* hot reload */
+    bool hotReload;
+    /* true when theme files may change: hot reload or custom files */
+    bool trackChanges;
+    QFileSystemWatcher *hotReloadWatcher;
+    QTimer *hotReloadTimer;
+    /* groups used by each painted widget, while tracking changes */
+    mutable QHash<const QWidget *, QSet<QString> > changeTrackedUsers;
+
     /* current theme and palette */
     QString curTheme, curPalette;
 
-    /* timer used for progress bars */
-    QTimer *progresstimer;
+    /* drives all the animations */
+    QSvgAnimationScheduler *animations;
+
+    /* paint area counter */
+    bool countPaintArea;
+    quint64 paintArea;
 
     /* List of registered widgets for a animations */
     QList<QWidget *> animatedWidgets;
 
-    /* List of busy progress bars */
-    QMap<QWidget *,int> progressbars;
-
     /* QSvgStyle debugging capabilities */
     bool dbgWireframe, dbgOverdraw;
 };
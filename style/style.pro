@@ -9,25 +9,30 @@ TARGET = qsvgstyle
 DESTDIR = plugins
 TEMPLATE = lib
 
-QT += core gui widgets svg
+QT += core gui widgets svg core5compat concurrent
 
 INCLUDEPATH += ../styleconfig
 
 PRE_TARGETDEPS += \
-  ../styleconfig/lib/libQSvgStyleConfig.a
+  ../styleconfig/lib/libQSvgStyleConfig.a \
+  ../thirdparty/quazip/lib/libquazip.a
 
 LIBS += \
-  ../styleconfig/lib/libQSvgStyleConfig.a
+  ../styleconfig/lib/libQSvgStyleConfig.a \
+  ../thirdparty/quazip/lib/libquazip.a \
+  -lz
 
 HEADERS += \
   QSvgThemableStyle.h \
   QSvgStylePlugin.h \
-  QSvgCachedRenderer.h
+  QSvgCachedRenderer.h \
+  QSvgAnimationScheduler.h
 
 SOURCES += \
   QSvgThemableStyle.cpp \
   QSvgStylePlugin.cpp \
-  QSvgCachedRenderer.cpp
+  QSvgCachedRenderer.cpp \
+  QSvgAnimationScheduler.cpp
 
 RESOURCES += \
   defaulttheme.qrc
@@ -23,13 +23,17 @@
 #include <QDebug>
 #include <QString>
 #include <QVariant>
-#include <QSettings>
 #include <QFile>
 #include <QStringList>
+#include <QReadLocker>
+#include <QWriteLocker>
+
+#include "QSvgIniFile.h"
+#include "ThemePackage.h"
 
 QSvgCachedSettings::QSvgCachedSettings()
   : usecache(true),
-    settings(NULL)
+    reloadGeneration(0)
 {
 }
 
@@ -42,32 +46,116 @@ QSvgCachedSettings::QSvgCachedSettings(const QString &file)
 QSvgCachedSettings::~QSvgCachedSettings()
 {
   if ( settings ) {
-    commitWriteCache();
-    delete settings;
+    sync();
   }
 }
 
 void QSvgCachedSettings::load(const QString &filename)
 {
   if (settings) {
-    commitWriteCache();
-    delete settings;
+    sync();
   }
 
-  settings = NULL;
+  settings.reset();
   invalidateCache();
 
   if (!QFile::exists(filename))
     return;
 
-  settings = new QSettings(filename,QSettings::IniFormat);
+  if ( ThemePackage::isPackage(filename) ) {
+    // read only, in-memory configuration
+    settings = QSvgIniFile::fromData(ThemePackage::readConfig(filename));
+  } else {
+    // shared with other objects using the same file
+    settings = QSvgIniFile::open(filename);
+  }
+
   file = filename;
+  reloadGeneration = settings->generation();
+  cacheGeneration.storeRelease(reloadGeneration);
+}
+
+void QSvgCachedSettings::loadCopy(const QString &filename)
+{
+  if (settings) {
+    sync();
+  }
+
+  settings.reset();
+  invalidateCache();
+
+  if (!QFile::exists(filename))
+    return;
+
+  if ( ThemePackage::isPackage(filename) ) {
+    settings = QSvgIniFile::fromData(ThemePackage::readConfig(filename));
+  } else {
+    QFile f(filename);
+    if ( f.open(QIODevice::ReadOnly) )
+      settings = QSvgIniFile::fromData(f.readAll());
+  }
+
+  file = filename;
+  if ( settings ) {
+    reloadGeneration = settings->generation();
+    cacheGeneration.storeRelease(reloadGeneration);
+  }
 }
 
 void QSvgCachedSettings::invalidateCache()
 {
+  QWriteLocker l(&cacheLock);
   readCache.clear();
   writeCache.clear();
+  pendingKeys.clear();
+}
+
+QStringList QSvgCachedSettings::reload()
+{
+  // unwritten values take precedence over the file contents
+  if ( !settings || !writeCache.isEmpty() )
+    return QStringList();
+
+  // packages are not shared, their configuration is read again here
+  if ( ThemePackage::isPackage(file) )
+    settings->reload(ThemePackage::readConfig(file));
+  else
+    settings->reload();
+
+  // other objects sharing the file may have reloaded it already
+  const QStringList changed = settings->changedGroups(reloadGeneration);
+  reloadGeneration = settings->generation();
+
+  dropReloadedGroups();
+
+  return changed;
+}
+
+void QSvgCachedSettings::dropReloadedGroups() const
+{
+  // fast path, reloads are rare
+  const int g = settings->generation();
+  if ( g == cacheGeneration.loadAcquire() )
+    return;
+
+  QWriteLocker l(&cacheLock);
+  const int seen = cacheGeneration.loadAcquire();
+  if ( g == seen )
+    return;
+
+  foreach (QString group, settings->changedGroups(seen)) {
+    const QString prefix = group+"/";
+    QHash<QString,QVariant>::iterator it = readCache.begin();
+    while ( it != readCache.end() ) {
+      // values set through this object and not written yet are kept
+      if ( it.key().startsWith(prefix) && !pendingKeys.contains(it.key()) )
+        it = readCache.erase(it);
+      else
+        ++it;
+    }
+  }
+
+  cacheGeneration.storeRelease(g);
 }
 
 void QSvgCachedSettings::setUseCache(bool enabled)
@@ -86,18 +174,23 @@ QVariant QSvgCachedSettings::getRawValue(const QString &group, const QString &ke
   if ( !settings )
     return QVariant();
 
-  // read from cache
-  if ( usecache && readCache.contains(k) )
-    return readCache.value(k);
+  // the file may have been reloaded through another object
+  dropReloadedGroups();
 
-  // read from file and cache it
-  if ( !settings )
-    return QVariant();
+  // read from cache. Styles may read from worker threads
+  if ( usecache ) {
+    QReadLocker l(&cacheLock);
+    QHash<QString,QVariant>::const_iterator it = readCache.constFind(k);
+    if ( it != readCache.constEnd() )
+      return it.value();
+  }
 
-  QVariant v = settings->value(k);
+  // read from file and cache it
+  QVariant v = settings->value(group,key);
 
   // even if not using cache, cache the value to anticipate a future
   // use of cache
+  QWriteLocker l(&cacheLock);
   readCache.insert(k,v);
 
   return v;
@@ -127,19 +220,19 @@ void QSvgCachedSettings::setValue(const QString& group, const QString& key, cons
 {
   const QString k = group+"/"+key;
 
-  if ( !settings )
+  if ( !settings || settings->isReadOnly() )
     return;
 
   if ( usecache ) {
-    writeCache.insert(k,v);
+    writeCache[group].insert(key,v);
     // also store in read cache for fast retrieval
+    QWriteLocker l(&cacheLock);
     readCache.insert(k, v);
+    pendingKeys.insert(k);
   } else {
-    if ( v.isNull() ) {
-      settings->remove(k);
-    } else {
-      settings->setValue(k,v);
-    }
+    // null values remove the key
+    settings->setValue(group,key,v);
+    settings->scheduleSync();
   }
 }
 
@@ -148,44 +241,48 @@ void QSvgCachedSettings::removeAllWithPrefix(const QString &group, const QString
   if ( !settings )
     return;
 
-  settings->beginGroup(group);
-  QStringList keys = settings->childKeys();
-  settings->endGroup();
+  QStringList keys = settings->childKeysWithPrefix(group, prefix);
 
-  foreach (QString k, keys) {
-    if ( k.startsWith(prefix) ) {
-      setValue(group, k, QVariant());
+  // also clear pending keys not yet written to the file
+  if ( usecache && writeCache.contains(group) ) {
+    const QMap<QString,QVariant> &pending = writeCache[group];
+    for (QMap<QString,QVariant>::const_iterator it = pending.lowerBound(prefix);
+         (it != pending.constEnd()) && it.key().startsWith(prefix); ++it) {
+      if ( !it.value().isNull() )
+        keys << it.key();
     }
   }
+
+  foreach (QString k, keys) {
+    setValue(group, k, QVariant());
+  }
 }
 
 void QSvgCachedSettings::commitWriteCache()
 {
-  QHash<QString,QVariant>::const_iterator it;
-
   if ( !settings )
     return;
 
-  if ( usecache ) {
-    for (it = writeCache.constBegin(); it != writeCache.constEnd(); ++it) {
-      const QString k = it.key();
-      const QVariant v = it.value();
-
-      if ( v.isNull() ) {
-        // Null value -> this means we want to inherit it
-        // so delete key in file
-        settings->remove(k);
-        qWarning() << "clearing" << k;
-      } else {
-        qWarning() << "setting" << k << "to" << v;
-        settings->setValue(k,v);
-      }
-    }
+  if ( usecache && !writeCache.isEmpty() ) {
+    // applied as a single transaction so that other users of the file
+    // never see a half written configuration
+    settings->setValues(writeCache);
 
     // everything has been written, so clear write cache
     writeCache.clear();
+    QWriteLocker l(&cacheLock);
+    pendingKeys.clear();
   }
 
-  // sync into filesystem
-  settings->sync();
+  // written to the filesystem in the background
+  settings->scheduleSync();
+}
+
+void QSvgCachedSettings::sync()
+{
+  if ( !settings )
+    return;
+
+  commitWriteCache();
+  settings->waitForSync();
 }
@@ -21,13 +21,22 @@
 #define QSVGCACHEDSETTINGS_H
 
 #include <QHash>
+#include <QMap>
+#include <QSet>
+#include <QSharedPointer>
+#include <QStringList>
+#include <QReadWriteLock>
+#include <QAtomicInt>
 
 class QString;
 class QVariant;
-class QSettings;
+class QSvgIniFile;
 
 /**
- * @brief Wrapper around QSettings class with read/write caching capabilities
+ * @brief Wrapper around QSvgIniFile class with read/write caching capabilities
+ *
+ * Values can be read from several threads at once. Writing is reserved
+ * to the thread owning the object
  */
 class QSvgCachedSettings
 {
@@ -39,19 +48,34 @@ class QSvgCachedSettings
     /**
      * Loads the given configuration file. If a file is already loaded,
      * its cache is committed (if used) and it is closed
+     * If the file is a theme package, the configuration file it contains
+     * is read into memory and is read only
      */
     void load(const QString &file);
 
+    /**
+     * Loads a read only copy of the given configuration file, not shared
+     * with other objects. Unlike @ref load, it can be used from any thread
+     */
+    void loadCopy(const QString &file);
+
     /**
      * Returns the loaded filename
      */
     QString filename() const { return file; }
 
     /**
-     * Writes any cached values to the configuration file
+     * Writes any cached values to the configuration file. The values are
+     * applied at once and the file is written in the background
      */
     void commitWriteCache();
 
+    /**
+     * Writes any cached values to the configuration file and waits
+     * until the file is written
+     */
+    void sync();
+
     /**
      * Invalidates the current cache.
      * This forces values to be read from configuration file again
@@ -95,12 +119,32 @@ class QSvgCachedSettings
      */
     void setUseCache(bool enabled);
 
+    /**
+     * Reads the configuration file again if it has been modified by
+     * another process, or the configuration file of a theme package.
+     * Only the cached values of the groups that changed are invalidated.
+     * Returns the names of these groups, including the ones changed by
+     * reloads made meanwhile through other objects sharing the file
+     */
+    QStringList reload();
+
   private:
+    /* Drops the cached values of the groups reloaded since last time */
+    void dropReloadedGroups() const;
+
     bool usecache;
     QString file;
-    QSettings *settings;
+    QSharedPointer<QSvgIniFile> settings;
     mutable QHash<QString,QVariant> readCache;
-    QHash<QString,QVariant> writeCache;
+    /* keys of readCache not committed yet, kept on reloads */
+    QSet<QString> pendingKeys;
+    /* protects readCache, values may be read from several threads */
+    mutable QReadWriteLock cacheLock;
+    /* generations of the file seen by readCache and by reload() */
+    mutable QAtomicInt cacheGeneration;
+    int reloadGeneration;
+    /* group -> key -> value */
+    QHash<QString,QMap<QString,QVariant> > writeCache;
 };
 
 #endif
@@ -0,0 +1,765 @@
+/***************************************************************************
+ *   Copyright (C) 2014 by Saïd LANKRI   *
+ *   said.lankri@gmail.com   *
+ *                                                                         *
+ *   This program is free software; you can redistribute it and/or modify  *
+ *   it under the terms of the GNU General Public License as published by  *
+ *   the Free Software Foundation; either version 2 of the License, or     *
+ *   (at your option) any later version.                                   *
+ *                                                                         *
+ *   This program is distributed in the hope that it will be useful,       *
+ *   but WITHOUT ANY WARRANTY; without even the implied warranty of        *
+ *   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the         *
+ *   GNU General Public License for more details.                          *
+ *                                                                         *
+ *   You should have received a copy of the GNU General Public License     *
+ *   along with this program; if not, write to the                         *
+ *   Free Software Foundation, Inc.,                                       *
+ *   59 Temple Place - Suite 330, Boston, MA  02111-1307, USA.             *
+ ***************************************************************************/
+#include "QSvgIniFile.h"
+
+#include <string.h>
+
+#include <QDebug>
+#include <QFile>
+#include <QFileInfo>
+#include <QMutex>
+#include <QWaitCondition>
+#include <QWeakPointer>
+#include <QSaveFile>
+#include <QtConcurrent>
+
+/* Shared instances, by absolute file name */
+typedef struct ini_registry_t {
+  QMutex lock;
+  QHash<QString,QWeakPointer<QSvgIniFile> > files;
+  // signaled when an instance is gone from files
+  QWaitCondition removed;
+} ini_registry_t;
+
+/*
+ * Process wide, like QSettings objects share their data inside a
+ * process. Libraries linking their own copy of this class have their
+ * own registry
+ */
+Q_GLOBAL_STATIC(ini_registry_t, iniRegistry)
+
+/* Returns the given view without leading and trailing white spaces */
+static QByteArrayView trimmedView(QByteArrayView v)
+{
+  qsizetype b = 0, e = v.size();
+
+  while ( (b < e) && ((v[b] == ' ') || (v[b] == '\t') || (v[b] == '\r')) )
+    b++;
+  while ( (e > b) && ((v[e-1] == ' ') || (v[e-1] == '\t') || (v[e-1] == '\r')) )
+    e--;
+
+  return v.sliced(b, e-b);
+}
+
+/* Returns the index of the given char inside the view, or -1 */
+static qsizetype indexOfChar(QByteArrayView v, char c)
+{
+  if ( v.isEmpty() )
+    return -1;
+
+  const char *p = static_cast<const char *>(memchr(v.data(), c, v.size()));
+  return p ? p-v.data() : -1;
+}
+
+static bool isHexDigit(uchar c)
+{
+  return ((c >= '0') && (c <= '9')) || ((c >= 'a') && (c <= 'f')) ||
+         ((c >= 'A') && (c <= 'F'));
+}
+
+static uint hexValue(uchar c)
+{
+  if ( c <= '9' )
+    return c-'0';
+  if ( c <= 'F' )
+    return c-'A'+10;
+  return c-'a'+10;
+}
+
+/* Values starting with '@' are written with an "@@" prefix, like QSettings */
+static QString escapedAt(const QString &s)
+{
+  return s.startsWith('@') ? '@'+s : s;
+}
+
+static QString unescapedAt(const QString &s)
+{
+  return s.startsWith("@@") ? s.mid(1) : s;
+}
+
+QSvgIniFile::QSvgIniFile()
+  : readonly(false),
+    dirty(false),
+    writerRunning(false),
+    writeRequested(false)
+{
+}
+
+QSvgIniFile::~QSvgIniFile()
+{
+  scheduleSync();
+  waitForSync();
+
+  // shared instances may outlive the registry at exit
+  if ( !file.isEmpty() && !iniRegistry.isDestroyed() ) {
+    ini_registry_t *registry = iniRegistry();
+    QMutexLocker locker(&registry->lock);
+    // another instance may have been opened for the same file meanwhile
+    if ( registry->files.value(file).isNull() ) {
+      registry->files.remove(file);
+      registry->removed.wakeAll();
+    }
+  }
+}
+
+QSharedPointer<QSvgIniFile> QSvgIniFile::open(const QString &filename)
+{
+  const QString key = QFileInfo(filename).absoluteFilePath();
+
+  ini_registry_t *registry = iniRegistry();
+  QMutexLocker locker(&registry->lock);
+  QSharedPointer<QSvgIniFile> r;
+
+  forever {
+    r = registry->files.value(key).toStrongRef();
+    if ( r )
+      return r;
+
+    if ( !registry->files.contains(key) )
+      break;
+
+    // the last instance is being destroyed and may still be writing
+    // the file. Wait for it to be gone
+    registry->removed.wait(&registry->lock);
+  }
+
+  r = QSharedPointer<QSvgIniFile>(new QSvgIniFile());
+  r->file = key;
+
+  QFile f(filename);
+  if ( f.open(QIODevice::ReadOnly) ) {
+    r->readonly = !QFileInfo(filename).isWritable();
+
+    // tokens are views on the mapped file, only keys and values are copied
+    const qint64 size = f.size();
+    uchar *mem = (size > 0) ? f.map(0, size) : nullptr;
+    if ( mem ) {
+      r->parse(QByteArrayView(reinterpret_cast<const char *>(mem), size));
+      f.unmap(mem);
+    } else {
+      // e.g. compressed Qt resources
+      r->parse(f.readAll());
+    }
+    f.close();
+  }
+
+  registry->files.insert(key, r.toWeakRef());
+
+  return r;
+}
+
+QStringList QSvgIniFile::reload()
+{
+  QStringList changed;
+
+  if ( file.isEmpty() )
+    return changed;
+
+  // our own modifications take precedence
+  waitForSync();
+  {
+    QReadLocker locker(&lock);
+    if ( dirty )
+      return changed;
+  }
+
+  QFile f(file);
+  if ( !f.open(QIODevice::ReadOnly) )
+    return changed;
+
+  return replaceContents(f.readAll());
+}
+
+QStringList QSvgIniFile::reload(QByteArrayView data)
+{
+  // files are read again from the file system
+  if ( !file.isEmpty() )
+    return QStringList();
+
+  return replaceContents(data);
+}
+
+QStringList QSvgIniFile::replaceContents(QByteArrayView data)
+{
+  QStringList changed;
+
+  QSvgIniFile fresh;
+  fresh.parse(data);
+
+  QWriteLocker locker(&lock);
+
+  // diff by key
+  QHash<QString,group_t>::const_iterator it;
+  for (it = fresh.groups.constBegin(); it != fresh.groups.constEnd(); ++it) {
+    if ( groups.value(it.key()) != it.value() )
+      changed << it.key();
+  }
+  for (it = groups.constBegin(); it != groups.constEnd(); ++it) {
+    if ( !fresh.groups.contains(it.key()) && !it.value().isEmpty() )
+      changed << it.key();
+  }
+
+  if ( !changed.isEmpty() ) {
+    groups = fresh.groups;
+    groupOrder = fresh.groupOrder;
+
+    const int g = gen.fetchAndAddOrdered(1)+1;
+    foreach (const QString &name, changed)
+      groupGenerations.insert(name, g);
+  }
+
+  return changed;
+}
+
+QStringList QSvgIniFile::changedGroups(int since) const
+{
+  QReadLocker locker(&lock);
+  QStringList r;
+
+  QHash<QString,int>::const_iterator it;
+  for (it = groupGenerations.constBegin(); it != groupGenerations.constEnd(); ++it) {
+    if ( it.value() > since )
+      r << it.key();
+  }
+
+  return r;
+}
+
+QSharedPointer<QSvgIniFile> QSvgIniFile::fromData(const QByteArray &data)
+{
+  QSharedPointer<QSvgIniFile> r(new QSvgIniFile());
+
+  r->parse(data);
+  r->readonly = true;
+
+  return r;
+}
+
+QVariant QSvgIniFile::value(const QString &group, const QString &key) const
+{
+  QReadLocker locker(&lock);
+
+  QHash<QString,group_t>::const_iterator it = groups.constFind(group);
+  if ( it == groups.constEnd() )
+    return QVariant();
+
+  group_t::const_iterator vit = it.value().constFind(key);
+  if ( vit == it.value().constEnd() )
+    return QVariant();
+
+  return toVariant(vit.value());
+}
+
+void QSvgIniFile::setValue(const QString &group, const QString &key, const QVariant &v)
+{
+  if ( readonly )
+    return;
+
+  QWriteLocker locker(&lock);
+
+  if ( v.isNull() ) {
+    QHash<QString,group_t>::iterator it = groups.find(group);
+    if ( (it != groups.end()) && it.value().remove(key) )
+      dirty = true;
+    return;
+  }
+
+  if ( !groups.contains(group) && !group.isEmpty() )
+    groupOrder.append(group);
+
+  groups[group].insert(key, fromVariant(v));
+  dirty = true;
+}
+
+QStringList QSvgIniFile::childKeys(const QString &group) const
+{
+  QReadLocker locker(&lock);
+
+  return groups.value(group).keys();
+}
+
+void QSvgIniFile::setValues(const QHash<QString,QMap<QString,QVariant> > &values)
+{
+  if ( readonly || values.isEmpty() )
+    return;
+
+  QWriteLocker locker(&lock);
+
+  QHash<QString,QMap<QString,QVariant> >::const_iterator git;
+  QMap<QString,QVariant>::const_iterator it;
+
+  for (git = values.constBegin(); git != values.constEnd(); ++git) {
+    const QString &group = git.key();
+
+    if ( !groups.contains(group) && !group.isEmpty() )
+      groupOrder.append(group);
+
+    group_t &g = groups[group];
+
+    for (it = git.value().constBegin(); it != git.value().constEnd(); ++it) {
+      if ( it.value().isNull() )
+        g.remove(it.key());
+      else
+        g.insert(it.key(), fromVariant(it.value()));
+    }
+  }
+
+  dirty = true;
+}
+
+QStringList QSvgIniFile::childKeysWithPrefix(const QString &group,
+                                             const QString &prefix) const
+{
+  QReadLocker locker(&lock);
+  QStringList r;
+
+  QHash<QString,group_t>::const_iterator git = groups.constFind(group);
+  if ( git == groups.constEnd() )
+    return r;
+
+  // keys are sorted, matching keys are contiguous
+  const group_t &g = git.value();
+  for (group_t::const_iterator it = g.lowerBound(prefix);
+       (it != g.constEnd()) && it.key().startsWith(prefix); ++it)
+    r << it.key();
+
+  return r;
+}
+
+void QSvgIniFile::scheduleSync()
+{
+  if ( readonly || file.isEmpty() )
+    return;
+
+  QMutexLocker locker(&writeMutex);
+
+  writeRequested = true;
+
+  if ( writerRunning ) {
+    // the running writer will pick the request up
+    return;
+  }
+
+  writerRunning = true;
+  (void)QtConcurrent::run([this]() { writeLoop(); });
+}
+
+void QSvgIniFile::waitForSync()
+{
+  QMutexLocker locker(&writeMutex);
+
+  while ( writerRunning )
+    writeDone.wait(&writeMutex);
+}
+
+void QSvgIniFile::writeLoop()
+{
+  forever {
+    {
+      QMutexLocker locker(&writeMutex);
+      if ( !writeRequested ) {
+        writerRunning = false;
+        writeDone.wakeAll();
+        return;
+      }
+      writeRequested = false;
+    }
+
+    // coalescing: only the latest contents are written
+    QByteArray data;
+    {
+      QWriteLocker locker(&lock);
+      if ( !dirty )
+        continue;
+      data = serialize();
+      dirty = false;
+    }
+
+    // write to a temporary file then rename it
+    QSaveFile f(file);
+    if ( !f.open(QIODevice::WriteOnly) || (f.write(data) != data.size()) ||
+         !f.commit() ) {
+      qWarning() << "[QSvgStyle]" << "Could not write" << file;
+    }
+  }
+}
+
+void QSvgIniFile::parse(QByteArrayView data)
+{
+  QWriteLocker locker(&lock);
+
+  QString group;
+  group_t *g = nullptr;
+  qsizetype pos = 0;
+
+  while ( pos < data.size() ) {
+    qsizetype eol = indexOfChar(data.sliced(pos), '\n');
+    if ( eol < 0 )
+      eol = data.size()-pos;
+
+    const QByteArrayView line = trimmedView(data.sliced(pos, eol));
+    pos += eol+1;
+
+    if ( line.isEmpty() || (line[0] == ';') || (line[0] == '#') )
+      continue;
+
+    if ( line[0] == '[' ) {
+      qsizetype end = indexOfChar(line, ']');
+      if ( end < 0 )
+        end = line.size();
+
+      const QByteArrayView name = trimmedView(line.sliced(1, end-1));
+
+      // same special sections as QSettings
+      if ( name.compare("General", Qt::CaseInsensitive) == 0 )
+        group.clear();
+      else if ( name.compare("%General", Qt::CaseInsensitive) == 0 )
+        group = QString::fromUtf8(name.sliced(1));
+      else
+        group = unescapedKey(name);
+
+      if ( !groups.contains(group) && !group.isEmpty() )
+        groupOrder.append(group);
+      g = &groups[group];
+      continue;
+    }
+
+    const qsizetype eq = indexOfChar(line, '=');
+    if ( eq <= 0 )
+      continue;
+
+    if ( !g )
+      g = &groups[group];
+
+    value_t v;
+    if ( parseValue(trimmedView(line.sliced(eq+1)), v) )
+      g->insert(unescapedKey(trimmedView(line.first(eq))), v);
+  }
+}
+
+bool QSvgIniFile::parseValue(QByteArrayView raw, value_t &v)
+{
+  v.isList = false;
+
+  // fast path: plain string, no need to unquote, unescape nor to split
+  bool plain = raw.isEmpty() || (raw[0] != '@');
+  for (qsizetype i=0; plain && (i<raw.size()); i++) {
+    const char c = raw[i];
+    if ( (c == '"') || (c == '\\') || (c == ',') || (c == ';') )
+      plain = false;
+  }
+
+  if ( plain ) {
+    v.string = QString::fromUtf8(raw);
+    return true;
+  }
+
+  QStringList parts;
+  QByteArray cur;
+  bool inQuotes = false;
+  bool quoted = false;
+
+  cur.reserve(raw.size());
+
+  for (qsizetype i=0; i<raw.size(); i++) {
+    const char c = raw[i];
+
+    if ( c == '"' ) {
+      inQuotes = !inQuotes;
+      quoted = true;
+    } else if ( (c == '\\') && (i+1 < raw.size()) ) {
+      const char n = raw[++i];
+      switch ( n ) {
+        case 'a' : cur += '\a'; break;
+        case 'b' : cur += '\b'; break;
+        case 'f' : cur += '\f'; break;
+        case 'n' : cur += '\n'; break;
+        case 'r' : cur += '\r'; break;
+        case 't' : cur += '\t'; break;
+        case 'v' : cur += '\v'; break;
+        case 'x' :
+        case '0' : case '1' : case '2' : case '3' :
+        case '4' : case '5' : case '6' : case '7' : {
+          // \x hex and octal escapes give a character code
+          const bool hex = (n == 'x');
+          uint code = hex ? 0 : n-'0';
+          while ( i+1 < raw.size() ) {
+            const char d = raw[i+1];
+            if ( hex && isHexDigit(d) )
+              code = (code << 4) + hexValue(d);
+            else if ( !hex && (d >= '0') && (d <= '7') )
+              code = (code << 3) + (d-'0');
+            else
+              break;
+            i++;
+          }
+          cur += QString(QChar(char16_t(code))).toUtf8();
+          break;
+        }
+        default :
+          cur += n;
+      }
+    } else if ( !inQuotes && (c == ';') ) {
+      // trailing comment
+      break;
+    } else if ( !inQuotes && (c == ',') ) {
+      parts << QString::fromUtf8(quoted ? cur : cur.trimmed());
+      cur.clear();
+      quoted = false;
+      v.isList = true;
+    } else {
+      cur += c;
+    }
+  }
+
+  parts << QString::fromUtf8(quoted ? cur : cur.trimmed());
+
+  if ( v.isList ) {
+    v.list.clear();
+    foreach (const QString &s, parts)
+      v.list << unescapedAt(s);
+    return true;
+  }
+
+  if ( parts.at(0) == "@Invalid()" )
+    return false;
+
+  v.string = unescapedAt(parts.at(0));
+  return true;
+}
+
+QSvgIniFile::value_t QSvgIniFile::fromVariant(const QVariant &v)
+{
+  value_t r;
+
+  if ( v.typeId() == QMetaType::QStringList ) {
+    r.isList = true;
+    r.list = v.toStringList();
+  } else {
+    r.string = v.toString();
+  }
+
+  return r;
+}
+
+QVariant QSvgIniFile::toVariant(const value_t &v)
+{
+  if ( v.isList )
+    return QVariant(v.list);
+
+  return QVariant(v.string);
+}
+
+QString QSvgIniFile::unescapedKey(QByteArrayView raw)
+{
+  // fast path: nothing escaped
+  if ( (indexOfChar(raw, '%') < 0) && (indexOfChar(raw, '\\') < 0) )
+    return QString::fromUtf8(raw);
+
+  const QString decoded = QString::fromUtf8(raw);
+  QString r;
+  qsizetype i = 0;
+
+  r.reserve(decoded.size());
+
+  while ( i < decoded.size() ) {
+    const QChar c = decoded.at(i);
+
+    // QSettings group separators
+    if ( c == '\\' ) {
+      r += '/';
+      i++;
+      continue;
+    }
+
+    if ( (c != '%') || (i == decoded.size()-1) ) {
+      r += c;
+      i++;
+      continue;
+    }
+
+    // %XX or %UXXXX
+    qsizetype first = i+1;
+    int digits = 2;
+    if ( decoded.at(first) == 'U' ) {
+      first++;
+      digits = 4;
+    }
+
+    bool ok = false;
+    ushort code = 0;
+    if ( first+digits <= decoded.size() )
+      code = QStringView(decoded).sliced(first, digits).toUShort(&ok, 16);
+
+    if ( !ok ) {
+      r += '%';
+      i++;
+      continue;
+    }
+
+    r += QChar(code);
+    i = first+digits;
+  }
+
+  return r;
+}
+
+QByteArray QSvgIniFile::escapedKey(const QString &key)
+{
+  static const char hexDigits[] = "0123456789ABCDEF";
+  QByteArray r;
+
+  r.reserve(key.size()*3/2);
+
+  for (qsizetype i=0; i<key.size(); i++) {
+    const ushort c = key.at(i).unicode();
+
+    if ( c == '/' ) {
+      r += '\\';
+    } else if ( ((c >= 'a') && (c <= 'z')) || ((c >= 'A') && (c <= 'Z')) ||
+                ((c >= '0') && (c <= '9')) || (c == '_') || (c == '-') || (c == '.') ) {
+      r += (char)c;
+    } else if ( c <= 0xFF ) {
+      r += '%';
+      r += hexDigits[c >> 4];
+      r += hexDigits[c & 0xF];
+    } else {
+      r += "%U";
+      r += hexDigits[(c >> 12) & 0xF];
+      r += hexDigits[(c >> 8) & 0xF];
+      r += hexDigits[(c >> 4) & 0xF];
+      r += hexDigits[c & 0xF];
+    }
+  }
+
+  return r;
+}
+
+void QSvgIniFile::escapedString(const QString &s, QByteArray &out)
+{
+  const QByteArray u = s.toUtf8();
+  const qsizetype start = out.size();
+  bool quote = false;
+  // a hex digit following a \x escape would be read as part of it
+  bool escapeNextIfDigit = false;
+
+  out.reserve(start+u.size()+2);
+
+  for (qsizetype i=0; i<u.size(); i++) {
+    const uchar c = u[i];
+
+    if ( (c == ',') || (c == ';') || (c == '=') )
+      quote = true;
+
+    if ( escapeNextIfDigit && isHexDigit(c) ) {
+      out += "\\x" + QByteArray::number(c, 16);
+      continue;
+    }
+    escapeNextIfDigit = false;
+
+    switch ( c ) {
+      case '\0' :
+        out += "\\0";
+        escapeNextIfDigit = true;
+        break;
+      case '\a' : out += "\\a"; break;
+      case '\b' : out += "\\b"; break;
+      case '\f' : out += "\\f"; break;
+      case '\n' : out += "\\n"; break;
+      case '\r' : out += "\\r"; break;
+      case '\t' : out += "\\t"; break;
+      case '\v' : out += "\\v"; break;
+      case '"' :
+      case '\\' :
+        out += '\\';
+        out += (char)c;
+        break;
+      default :
+        if ( c <= 0x1F ) {
+          out += "\\x" + QByteArray::number(c, 16);
+          escapeNextIfDigit = true;
+        } else {
+          // UTF-8 sequences are written as is
+          out += (char)c;
+        }
+    }
+  }
+
+  if ( quote ||
+       ((start < out.size()) && ((out.at(start) == ' ') || (out.back() == ' '))) ) {
+    out.insert(start, '"');
+    out += '"';
+  }
+}
+
+QByteArray QSvgIniFile::escapedValue(const value_t &v)
+{
+  QByteArray r;
+
+  if ( !v.isList ) {
+    escapedString(escapedAt(v.string), r);
+    return r;
+  }
+
+  // an empty list reads back as a null value, as with QSettings
+  if ( v.list.isEmpty() )
+    return "@Invalid()";
+
+  for (qsizetype i=0; i<v.list.size(); i++) {
+    if ( i > 0 )
+      r += ", ";
+    escapedString(escapedAt(v.list.at(i)), r);
+  }
+
+  return r;
+}
+
+QByteArray QSvgIniFile::serialize() const
+{
+  QByteArray out;
+  QStringList order = groupOrder;
+
+  // top level keys first, like QSettings
+  order.prepend(QString());
+
+  foreach (const QString &name, order) {
+    const group_t g = groups.value(name);
+
+    if ( g.isEmpty() )
+      continue;
+
+    if ( !out.isEmpty() )
+      out += '\n';
+
+    const QByteArray section = escapedKey(name);
+    if ( section.isEmpty() )
+      out += "[General]\n";
+    else if ( section.compare("General", Qt::CaseInsensitive) == 0 )
+      out += "[%" + section + "]\n";
+    else
+      out += '[' + section + "]\n";
+
+    for (group_t::const_iterator it = g.constBegin(); it != g.constEnd(); ++it) {
+      out += escapedKey(it.key()) + '=' + escapedValue(it.value()) + '\n';
+    }
+  }
+
+  return out;
+}
@@ -0,0 +1,210 @@
+/***************************************************************************
+ *   Copyright (C) 2014 by Saïd LANKRI   *
+ *   said.lankri@gmail.com   *
+ *                                                                         *
+ *   This program is free software; you can redistribute it and/or modify  *
+ *   it under the terms of the GNU General Public License as published by  *
+ *   the Free Software Foundation; either version 2 of the License, or     *
+ *   (at your option) any later version.                                   *
+ *                                                                         *
+ *   This program is distributed in the hope that it will be useful,       *
+ *   but WITHOUT ANY WARRANTY; without even the implied warranty of        *
+ *   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the         *
+ *   GNU General Public License for more details.                          *
+ *                                                                         *
+ *   You should have received a copy of the GNU General Public License     *
+ *   along with this program; if not, write to the                         *
+ *   Free Software Foundation, Inc.,                                       *
+ *   59 Temple Place - Suite 330, Boston, MA  02111-1307, USA.             *
+ ***************************************************************************/
+#ifndef QSVGINIFILE_H
+#define QSVGINIFILE_H
+
+#include <QString>
+#include <QStringList>
+#include <QVariant>
+#include <QMap>
+#include <QHash>
+#include <QByteArrayView>
+#include <QReadWriteLock>
+#include <QSharedPointer>
+#include <QMutex>
+#include <QWaitCondition>
+#include <QAtomicInt>
+
+/**
+ * @brief Dedicated parser and writer for QSvgStyle configuration files
+ *
+ * Configuration files are INI files as written by QSettings. This class
+ * reads them by memory mapping the file and tokenizing it in place, only
+ * allocating for the parsed keys and values. Values are stored as what
+ * the INI syntax can express, a string or a list of strings, and only
+ * turned into a QVariant when read.
+ *
+ * Keys, section names and values are escaped and unescaped like
+ * QSettings does, including the "@@" prefix of values starting with '@'
+ * and "@Invalid()" for null values. Values QSettings writes with other
+ * '@' prefixes, e.g. "@ByteArray(...)" or "@Variant(...)", are not
+ * decoded but kept as strings: QSvgStyle configuration files only hold
+ * strings, numbers and lists.
+ *
+ * Like QSettings, all the objects created for the same file inside a
+ * process share the same data, so a value written through one object is
+ * immediately seen by the others. Use @ref open to get the shared instance
+ * of a file.
+ */
+class QSvgIniFile
+{
+  public:
+    /**
+     * Returns the shared instance for the given file, loading it if needed
+     */
+    static QSharedPointer<QSvgIniFile> open(const QString &file);
+
+    /**
+     * Returns a read only instance holding the given INI data
+     */
+    static QSharedPointer<QSvgIniFile> fromData(const QByteArray &data);
+
+    ~QSvgIniFile();
+
+    /**
+     * Returns the file name, empty for in-memory instances
+     */
+    QString fileName() const { return file; }
+
+    /**
+     * Returns whether this instance can be modified
+     */
+    bool isReadOnly() const { return readonly; }
+
+    /**
+     * Returns the value of the given key, or a null QVariant
+     */
+    QVariant value(const QString &group, const QString &key) const;
+
+    /**
+     * Sets the value of the given key. A null value removes the key
+     */
+    void setValue(const QString &group, const QString &key, const QVariant &v);
+
+    /**
+     * Sets all the given values at once: group -> key -> value.
+     * Null values remove their key
+     */
+    void setValues(const QHash<QString,QMap<QString,QVariant> > &values);
+
+    /**
+     * Returns the keys of the given group
+     */
+    QStringList childKeys(const QString &group) const;
+
+    /**
+     * Returns the keys of the given group starting with the given prefix
+     */
+    QStringList childKeysWithPrefix(const QString &group,
+                                    const QString &prefix) const;
+
+    /**
+     * Schedules the writing of the contents to the file if they have been
+     * modified. The file is written by a background writer, by replacing
+     * it atomically. Successive requests made while a write is in progress
+     * are coalesced into a single write
+     */
+    void scheduleSync();
+
+    /**
+     * Waits until all scheduled writes are done
+     */
+    void waitForSync();
+
+    /**
+     * Reads the file again if it has been modified by another process and
+     * returns the names of the groups whose contents changed. Nothing is
+     * read if this instance has unwritten modifications
+     */
+    QStringList reload();
+
+    /**
+     * Replaces the contents of an in-memory instance with the given INI
+     * data, e.g. read again from a theme package, and returns the names
+     * of the groups whose contents changed
+     */
+    QStringList reload(QByteArrayView data);
+
+    /**
+     * Returns a counter incremented each time a reload changes the
+     * contents. Objects caching values use it to notice reloads made
+     * through other objects sharing this instance
+     */
+    int generation() const { return gen.loadAcquire(); }
+
+    /**
+     * Returns the names of the groups changed by the reloads made since
+     * the given generation
+     */
+    QStringList changedGroups(int since) const;
+
+    /**
+     * Parses INI data. Top level keys (in the [General] section)
+     * are stored in the group with an empty name
+     */
+    void parse(QByteArrayView data);
+
+  private:
+    QSvgIniFile();
+
+    /* Returns the contents as INI data. Caller must hold the lock */
+    QByteArray serialize() const;
+
+    /* Background writer loop */
+    void writeLoop();
+
+    /* Replaces the contents with the given ones, returns the changed groups */
+    QStringList replaceContents(QByteArrayView data);
+
+    /* A value as the INI syntax expresses it */
+    typedef struct value_t {
+      QString string;
+      QStringList list;
+      bool isList;
+
+      value_t() : isList(false) {}
+      bool operator==(const value_t &o) const {
+        return (isList == o.isList) && (isList ? (list == o.list) : (string == o.string));
+      }
+      bool operator!=(const value_t &o) const { return !(*this == o); }
+    } value_t;
+
+    static bool parseValue(QByteArrayView raw, value_t &v);
+    static value_t fromVariant(const QVariant &v);
+    static QVariant toVariant(const value_t &v);
+    static QByteArray escapedValue(const value_t &v);
+    static void escapedString(const QString &s, QByteArray &out);
+    static QString unescapedKey(QByteArrayView raw);
+    static QByteArray escapedKey(const QString &key);
+
+    typedef QMap<QString,value_t> group_t;
+
+    QString file;
+    bool readonly;
+    bool dirty;
+
+    /* groups, in file order */
+    QStringList groupOrder;
+    QHash<QString,group_t> groups;
+
+    /* reload counter, and generation of the last change of each group */
+    QAtomicInt gen;
+    QHash<QString,int> groupGenerations;
+
+    mutable QReadWriteLock lock;
+
+    /* background writer state */
+    QMutex writeMutex;
+    QWaitCondition writeDone;
+    bool writerRunning;
+    bool writeRequested;
+};
+
+#endif // QSVGINIFILE_H
@@ -36,6 +36,57 @@
 #include <QStandardPaths>
 #endif
 #include <QDir>
+#include <QFileInfo>
+#include <QDateTime>
+#include <QDataStream>
+#include <QSaveFile>
+#include <QHash>
+#include <QtConcurrent>
+#include <QCoreApplication>
+
+#include "ThemePackage.h"
+
+/* Theme index file format */
+#define THEME_INDEX_MAGIC   0x51535449 /* "QSTI" */
+#define THEME_INDEX_VERSION 1
+
+/**
+ * Entry of the theme index. A theme is rescanned whenever
+ * the modification time or the size of its config file (or package) changes
+ */
+typedef struct theme_index_entry_t {
+  theme_index_entry_t() : mtime(-1), size(-1), valid(false) {
+    spec.system = false;
+  }
+
+  QString path;
+  qint64 mtime;
+  qint64 size;
+  /* false for packages lacking the config or the SVG file */
+  bool valid;
+  theme_spec_t spec;
+} theme_index_entry_t;
+
+/* Reads the theme spec of the given index entry from its config file */
+static theme_index_entry_t readThemeIndexEntry(const theme_index_entry_t &e)
+{
+  theme_index_entry_t r = e;
+
+  r.valid = !ThemePackage::isPackage(r.path) || ThemePackage::isValid(r.path);
+  if ( !r.valid )
+    return r;
+
+  // runs in worker threads: do not use the instances shared with
+  // the other objects opening the same file
+  ThemeConfig t;
+  t.loadCopy(r.path);
+  const bool system = r.spec.system;
+  r.spec = t.getThemeSpec();
+  r.spec.path = r.path;
+  r.spec.system = system;
+
+  return r;
+}
 
 
 StyleConfig::StyleConfig()
@@ -91,56 +142,188 @@ QString StyleConfig::getUserConfigFile()
   return getUserConfigDir().absolutePath().append("/qsvgstyle.cfg");
 }
 
+QString StyleConfig::getThemeIndexFile()
+{
+  return QStandardPaths::writableLocation(QStandardPaths::GenericCacheLocation)
+      .append("/QSvgStyle/themes.idx");
+}
+
+QString StyleConfig::getUsageProfileFile()
+{
+  const QString app = QCoreApplication::applicationName();
+  if ( app.isEmpty() )
+    return QString();
+
+  return QStandardPaths::writableLocation(QStandardPaths::GenericCacheLocation)
+      .append("/QSvgStyle/profiles/").append(app).append(".prof");
+}
+
 QList<theme_spec_t> StyleConfig::getThemeList()
 {
   QList<theme_spec_t> result;
-  QDir cfgDir;
-  QStringList themeDirs;
+  QStringList candidates;
+  QHash<QString,bool> systemThemes;
 
   // get user themes
-  cfgDir = getUserConfigDir();
-  themeDirs = cfgDir.entryList(QStringList() << "*",
-                               QDir::Dirs | QDir::NoDotAndDotDot |
-                               QDir::Readable | QDir::Executable);
+  scanThemeDir(getUserConfigDir(), false, candidates, systemThemes);
 
-  Q_FOREACH(QString d, themeDirs) {
-    QString basename = cfgDir.absolutePath().append("/%1/%1").arg(d);
-    if ( QFile::exists(QString(basename).append(".svg")) &&
-         QFile::exists(QString(basename).append(".cfg"))
-    ) {
-      // both SVG and CFG found -> add theme
+  // get system themes
+  scanThemeDir(getSystemConfigDir(), true, candidates, systemThemes);
+
+  // Compare found themes against the index, only rescan
+  // new and modified ones
+  QHash<QString,theme_index_entry_t> index;
+  QHash<QString,theme_index_entry_t> newIndex;
+  QList<theme_index_entry_t> rescan;
+  bool dirty = false;
 
-      ThemeConfig t(QString(basename).append(".cfg"));
-      theme_spec_t ts = t.getThemeSpec();
-      ts.path = QString(basename).append(".cfg");
-      ts.system = false;
+  readThemeIndex(index);
 
-      result.append(ts);
+  Q_FOREACH(const QString &path, candidates) {
+    QFileInfo fi(path);
+    theme_index_entry_t e;
+
+    e.path = path;
+    e.mtime = fi.lastModified().toMSecsSinceEpoch();
+    e.size = fi.size();
+    e.spec.system = systemThemes.value(path);
+
+    if ( index.contains(path) ) {
+      const theme_index_entry_t &old = index[path];
+      if ( (old.mtime == e.mtime) && (old.size == e.size) &&
+           (old.spec.system == e.spec.system) ) {
+        newIndex.insert(path, old);
+        continue;
+      }
     }
+
+    rescan.append(e);
   }
 
-  // get system themes
-  cfgDir = getSystemConfigDir();
-  //qWarning() << "cfg dir" << cfgDir;
+  if ( !rescan.isEmpty() ) {
+    // reading themes configs is independent, do it in parallel
+    const QList<theme_index_entry_t> scanned =
+        QtConcurrent::blockingMapped(rescan, readThemeIndexEntry);
+
+    Q_FOREACH(const theme_index_entry_t &e, scanned) {
+      newIndex.insert(e.path, e);
+    }
+    dirty = true;
+  }
+
+  // removed themes
+  Q_FOREACH(const QString &path, index.keys()) {
+    if ( !newIndex.contains(path) ) {
+      dirty = true;
+      break;
+    }
+  }
+
+  if ( dirty )
+    writeThemeIndex(newIndex);
+
+  // keep the scanning order: user themes first
+  Q_FOREACH(const QString &path, candidates) {
+    const theme_index_entry_t &e = newIndex[path];
+    if ( e.valid )
+      result.append(e.spec);
+  }
+
+  return result;
+}
+
+void StyleConfig::scanThemeDir(const QDir &cfgDir, bool system,
+                               QStringList &candidates,
+                               QHash<QString,bool> &systemThemes)
+{
+  QStringList themeDirs;
+  QStringList themePackages;
+
+  // theme directories
   themeDirs = cfgDir.entryList(QStringList() << "*",
                                QDir::Dirs | QDir::NoDotAndDotDot |
                                QDir::Readable | QDir::Executable);
 
-  //qWarning() << themeDirs;
   Q_FOREACH(QString d, themeDirs) {
     QString basename = cfgDir.absolutePath().append("/%1/%1").arg(d);
-    if ( QFile::exists(QString(basename).append(".svg")) &&
+    if ( (QFile::exists(QString(basename).append(".svg")) ||
+          QFile::exists(QString(basename).append(".svgz"))) &&
          QFile::exists(QString(basename).append(".cfg"))
     ) {
       // both SVG and CFG found -> add theme
-
-      ThemeConfig t(QString(basename).append(".cfg"));
-      theme_spec_t ts = t.getThemeSpec();
-      ts.path = QString(basename).append(".cfg");
-      ts.system = true;
-      result.append(ts);
+      candidates.append(QString(basename).append(".cfg"));
+      systemThemes.insert(candidates.last(), system);
     }
   }
 
-  return result;
+  // theme packages. The package contents are checked when the theme
+  // is (re)scanned, see readThemeIndexEntry()
+  themePackages = cfgDir.entryList(QStringList() << "*.zip",
+                                   QDir::Files | QDir::Readable);
+
+  Q_FOREACH(QString p, themePackages) {
+    candidates.append(cfgDir.absoluteFilePath(p));
+    systemThemes.insert(candidates.last(), system);
+  }
+}
+
+void StyleConfig::readThemeIndex(QHash<QString,theme_index_entry_t> &index)
+{
+  QFile f(getThemeIndexFile());
+
+  if ( !f.open(QIODevice::ReadOnly) )
+    return;
+
+  QDataStream in(&f);
+  quint32 magic, version, count;
+
+  in >> magic >> version >> count;
+  if ( (magic != THEME_INDEX_MAGIC) || (version != THEME_INDEX_VERSION) )
+    return;
+
+  for (quint32 i=0; (i<count) && (in.status() == QDataStream::Ok); i++) {
+    theme_index_entry_t e;
+    QVariant name, variant, author, descr, keywords;
+
+    in >> e.path >> e.mtime >> e.size >> e.valid >> e.spec.system
+       >> name >> variant >> author >> descr >> keywords;
+
+    e.spec.name = value_t<QString>(name);
+    e.spec.variant = value_t<QString>(variant);
+    e.spec.author = value_t<QString>(author);
+    e.spec.descr = value_t<QString>(descr);
+    e.spec.keywords = value_t<QString>(keywords);
+    e.spec.path = e.path;
+
+    index.insert(e.path, e);
+  }
+
+  if ( in.status() != QDataStream::Ok ) {
+    qWarning() << "[QSvgStyle]" << "Corrupted theme index, rebuilding it";
+    index.clear();
+  }
+}
+
+void StyleConfig::writeThemeIndex(const QHash<QString,theme_index_entry_t> &index)
+{
+  QDir().mkpath(QFileInfo(getThemeIndexFile()).absolutePath());
+
+  QSaveFile f(getThemeIndexFile());
+
+  if ( !f.open(QIODevice::WriteOnly) )
+    return;
+
+  QDataStream out(&f);
+
+  out << (quint32)THEME_INDEX_MAGIC << (quint32)THEME_INDEX_VERSION
+      << (quint32)index.size();
+
+  Q_FOREACH(const theme_index_entry_t &e, index) {
+    out << e.path << e.mtime << e.size << e.valid << e.spec.system
+        << (QVariant)e.spec.name << (QVariant)e.spec.variant
+        << (QVariant)e.spec.author << (QVariant)e.spec.descr
+        << (QVariant)e.spec.keywords;
+  }
+
+  f.commit();
 }
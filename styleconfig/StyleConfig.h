@@ -27,7 +27,9 @@
 class QVariant;
 class QSettings;
 class QDir;
+class QStringList;
 template<typename T> class QList;
+struct theme_index_entry_t;
 
 /**
  * Class that loads, saves style settings
@@ -53,9 +55,25 @@ class StyleConfig : public QSvgCachedSettings {
 
     /**
      * Returns the list of themes. List contains user themes first
+     * Themes are either directories or theme packages (ZIP archives)
+     * For theme packages, the path of the theme is the path of the package
+     *
+     * Theme metadata is kept in an index file and themes are only
+     * read again when their config file (or package) has been modified
      */
     static QList<theme_spec_t> getThemeList();
 
+    /**
+     * Returns the theme index file used by @ref getThemeList
+     */
+    static QString getThemeIndexFile();
+
+    /**
+     * Returns the usage profile file of the running application, used
+     * to warm up the caches at startup
+     */
+    static QString getUsageProfileFile();
+
     /**
      * Returns the system config dir
      */
@@ -72,6 +90,19 @@ class StyleConfig : public QSvgCachedSettings {
     static QString getUserConfigFile();
 
   private:
+    /**
+     * Appends the path of the themes found in the given directory
+     * to @ref candidates
+     */
+    static void scanThemeDir(const QDir &cfgDir, bool system,
+                             QStringList &candidates,
+                             QHash<QString,bool> &systemThemes);
+
+    /**
+     * Reads and writes the theme index file
+     */
+    static void readThemeIndex(QHash<QString,theme_index_entry_t> &index);
+    static void writeThemeIndex(const QHash<QString,theme_index_entry_t> &index);
 };
 
 #endif // STYLECONFIG_H
@@ -0,0 +1,168 @@
+/***************************************************************************
+ *   Copyright (C) 2014 by Saïd LANKRI   *
+ *   said.lankri@gmail.com   *
+ *                                                                         *
+ *   This program is free software; you can redistribute it and/or modify  *
+ *   it under the terms of the GNU General Public License as published by  *
+ *   the Free Software Foundation; either version 2 of the License, or     *
+ *   (at your option) any later version.                                   *
+ *                                                                         *
+ *   This program is distributed in the hope that it will be useful,       *
+ *   but WITHOUT ANY WARRANTY; without even the implied warranty of        *
+ *   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the         *
+ *   GNU General Public License for more details.                          *
+ *                                                                         *
+ *   You should have received a copy of the GNU General Public License     *
+ *   along with this program; if not, write to the                         *
+ *   Free Software Foundation, Inc.,                                       *
+ *   59 Temple Place - Suite 330, Boston, MA  02111-1307, USA.             *
+ ***************************************************************************/
+#include "ThemePackage.h"
+
+#include <string.h>
+
+#include <QDebug>
+#include <QFile>
+#include <QFileInfo>
+#include <QStringList>
+
+#include <zlib.h>
+
+#include "quazip.h"
+#include "quazipfile.h"
+
+bool ThemePackage::isPackage(const QString &file)
+{
+  return QFileInfo(file).suffix().toLower() == "zip";
+}
+
+bool ThemePackage::isValid(const QString &package)
+{
+  if ( !isPackage(package) )
+    return false;
+
+  QuaZip zip(package);
+  if ( !zip.open(QuaZip::mdUnzip) )
+    return false;
+
+  const QStringList entries = zip.getFileNameList();
+  zip.close();
+
+  return !findEntry(entries, QStringList() << ".cfg").isEmpty() &&
+         !findEntry(entries, QStringList() << ".svg" << ".svgz").isEmpty();
+}
+
+QByteArray ThemePackage::readConfig(const QString &package)
+{
+  return readEntry(package, QStringList() << ".cfg");
+}
+
+QByteArray ThemePackage::readSvg(const QString &package)
+{
+  return readEntry(package, QStringList() << ".svg" << ".svgz");
+}
+
+QByteArray ThemePackage::readSvgXml(const QString &file)
+{
+  if ( isPackage(file) )
+    return gunzip(readSvg(file));
+
+  QFile f(file);
+  if ( !f.open(QIODevice::ReadOnly) )
+    return QByteArray();
+
+  return gunzip(f.readAll());
+}
+
+QString ThemePackage::svgFile(const QString &cfgFile)
+{
+  if ( isPackage(cfgFile) )
+    return cfgFile;
+
+  const QString basename = QFileInfo(cfgFile).absolutePath().append("/").append(
+                             QFileInfo(cfgFile).completeBaseName());
+
+  if ( !QFile::exists(basename+".svg") && QFile::exists(basename+".svgz") )
+    return basename+".svgz";
+
+  return basename+".svg";
+}
+
+QByteArray ThemePackage::gunzip(const QByteArray &data)
+{
+  // gzip magic
+  if ( (data.size() < 2) || ((uchar)data[0] != 0x1f) || ((uchar)data[1] != 0x8b) )
+    return data;
+
+  z_stream zs;
+  memset(&zs, 0, sizeof(zs));
+  // 16: expect a gzip header
+  if ( inflateInit2(&zs, 16+MAX_WBITS) != Z_OK )
+    return QByteArray();
+
+  QByteArray out;
+  char buf[16384];
+  int ret;
+
+  zs.next_in = reinterpret_cast<Bytef *>(const_cast<char *>(data.constData()));
+  zs.avail_in = data.size();
+
+  do {
+    zs.next_out = reinterpret_cast<Bytef *>(buf);
+    zs.avail_out = sizeof(buf);
+    ret = inflate(&zs, Z_NO_FLUSH);
+    if ( (ret != Z_OK) && (ret != Z_STREAM_END) ) {
+      out.clear();
+      break;
+    }
+    out.append(buf, sizeof(buf)-zs.avail_out);
+  } while ( ret != Z_STREAM_END );
+
+  inflateEnd(&zs);
+
+  return out;
+}
+
+QString ThemePackage::findEntry(const QStringList &entries,
+                                const QStringList &suffixes)
+{
+  // Suffixes are given by order of preference
+  Q_FOREACH(const QString &s, suffixes) {
+    Q_FOREACH(const QString &e, entries) {
+      if ( e.endsWith(s, Qt::CaseInsensitive) )
+        return e;
+    }
+  }
+
+  return QString();
+}
+
+QByteArray ThemePackage::readEntry(const QString &package,
+                                   const QStringList &suffixes)
+{
+  QByteArray data;
+
+  QuaZip zip(package);
+  if ( !zip.open(QuaZip::mdUnzip) ) {
+    qWarning() << "[QSvgStyle]" << "Could not open theme package" << package;
+    return data;
+  }
+
+  const QString entry = findEntry(zip.getFileNameList(), suffixes);
+
+  if ( !entry.isEmpty() && zip.setCurrentFile(entry) ) {
+    // entry is inflated on the fly into memory
+    QuaZipFile f(&zip);
+    if ( f.open(QIODevice::ReadOnly) ) {
+      data = f.readAll();
+      f.close();
+    }
+  }
+
+  zip.close();
+
+  if ( data.isEmpty() )
+    qWarning() << "[QSvgStyle]" << "No" << suffixes << "file in theme package" << package;
+
+  return data;
+}
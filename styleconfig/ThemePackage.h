@@ -0,0 +1,85 @@
+/***************************************************************************
+ *   Copyright (C) 2014 by Saïd LANKRI   *
+ *   said.lankri@gmail.com   *
+ *                                                                         *
+ *   This program is free software; you can redistribute it and/or modify  *
+ *   it under the terms of the GNU General Public License as published by  *
+ *   the Free Software Foundation; either version 2 of the License, or     *
+ *   (at your option) any later version.                                   *
+ *                                                                         *
+ *   This program is distributed in the hope that it will be useful,       *
+ *   but WITHOUT ANY WARRANTY; without even the implied warranty of        *
+ *   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the         *
+ *   GNU General Public License for more details.                          *
+ *                                                                         *
+ *   You should have received a copy of the GNU General Public License     *
+ *   along with this program; if not, write to the                         *
+ *   Free Software Foundation, Inc.,                                       *
+ *   59 Temple Place - Suite 330, Boston, MA  02111-1307, USA.             *
+ ***************************************************************************/
+#ifndef THEMEPACKAGE_H
+#define THEMEPACKAGE_H
+
+#include <QByteArray>
+#include <QString>
+
+class QStringList;
+
+/**
+ * Helper class to access themes packaged as a ZIP archive, as generated
+ * by QSvgThemeBuilder. Files are decompressed into memory buffers and
+ * never extracted to the disk
+ */
+class ThemePackage {
+  public:
+    /**
+     * Returns whether the given file is a theme package
+     */
+    static bool isPackage(const QString &file);
+
+    /**
+     * Returns whether the given package contains both a theme config
+     * file and a theme SVG file
+     */
+    static bool isValid(const QString &package);
+
+    /**
+     * Returns the decompressed contents of the theme config file
+     * of the given package. An empty array is returned on error
+     */
+    static QByteArray readConfig(const QString &package);
+
+    /**
+     * Returns the contents of the theme SVG file of the given package.
+     * The SVG file may be compressed (svgz), in which case the returned
+     * data is still gzipped. QSvgRenderer handles both formats.
+     * An empty array is returned on error
+     */
+    static QByteArray readSvg(const QString &package);
+
+    /**
+     * Returns the uncompressed XML contents of the given SVG file. The
+     * file can be a plain SVG file, a compressed SVG file (svgz) or a
+     * theme package. An empty array is returned on error
+     */
+    static QByteArray readSvgXml(const QString &file);
+
+    /**
+     * Returns the SVG file to use along with the given theme config file.
+     * For packages, this is the package itself. For theme directories,
+     * this is the .svg file, or the .svgz file if the former does not exist
+     */
+    static QString svgFile(const QString &cfgFile);
+
+  private:
+    /* Returns the name of the first entry having one of the given suffixes */
+    static QString findEntry(const QStringList &entries,
+                             const QStringList &suffixes);
+    /* Inflates gzipped data, returns the data unchanged if not gzipped */
+    static QByteArray gunzip(const QByteArray &data);
+    /* Returns the decompressed contents of the first matching entry */
+    static QByteArray readEntry(const QString &package,
+                                const QStringList &suffixes);
+};
+
+#endif // THEMEPACKAGE_H
@@ -8,14 +8,18 @@ TARGET   = QSvgStyleConfig
 DESTDIR  = lib
 TEMPLATE = lib
 
-QT      += core gui widgets
+QT      += core gui widgets core5compat concurrent
 
-INCLUDEPATH += ..
+INCLUDEPATH += .. ../thirdparty/quazip
+
+DEFINES += QUAZIP_STATIC
 
 SOURCES += \
   groups.cpp \
   ThemeConfig.cpp \
   StyleConfig.cpp \
+  ThemePackage.cpp \
+  QSvgIniFile.cpp \
   QSvgCachedSettings.cpp
 
 HEADERS += \
@@ -23,4 +27,6 @@ HEADERS += \
   groups.h \
   ThemeConfig.h \
   StyleConfig.h \
+  ThemePackage.h \
+  QSvgIniFile.h \
   QSvgCachedSettings.h
@@ -1289,10 +1289,10 @@ bool ThemeBuilderUI::openTheme(const QString& filename)
     svgFile.clear();
 
   if ( style && !svgFile.isEmpty() ) {
-    // NOTE Thanks to Qt, ThemeBuilder can modify this file safely while the style
+    // NOTE ThemeBuilder can modify this file safely while the style
     // uses it. Changes made by ThemeBuilder will be seen by the style immediately
-    // even if the style and ThemeBuilder use different QSettings objects for
-    // the same file location
+    // even if the style and ThemeBuilder use different ThemeConfig objects for
+    // the same file location, as they share the same QSvgIniFile
 
     // NOTE use invokeMethod, this allows us to not link against libqsvgstyle.so
     //style->loadCustomThemeConfig(tempCfgFile);
@@ -1510,7 +1510,8 @@ void ThemeBuilderUI::slot_saveTheme()
   // We normally don't need this
   saveSettingsFromUi(currentWidget);
 
-  config->commitWriteCache();
+  // the file is copied below, so wait for it to be written
+  config->sync();
 
   QFileDevice::Permissions p = QFile::permissions(cfgFile);
   if ( !QFile::remove(cfgFile) ) {
@@ -1771,10 +1772,10 @@ void ThemeBuilderUI::slot_reloadSvgFile()
 
   if ( style && !svgFile.isEmpty() ) {
     qDebug() << "[QSvgThemeBuilder]" << "SVG file changed, reloading it";
-    //style->loadCustomSVG(svgFile);
-    QStyle::staticMetaObject.invokeMethod(style,"loadCustomSVG",
-                                          Qt::DirectConnection,
-                                          Q_ARG(QString,svgFile));
+    // only the elements that changed are invalidated
+    //style->reloadChangedFiles();
+    QStyle::staticMetaObject.invokeMethod(style,"reloadChangedFiles",
+                                          Qt::DirectConnection);
     setupPreviewForWidget(currentWidget);
   }
 }
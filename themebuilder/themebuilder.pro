@@ -7,7 +7,7 @@ TARGET = qsvgthemebuilder
 DESTDIR = bin
 TEMPLATE = app
 
-QT += core gui xml widgets core5compat
+QT += core gui xml widgets core5compat concurrent
 
 INCLUDEPATH += . ../styleconfig ../thirdparty/svgcleaner ../thirdparty/quazip
 
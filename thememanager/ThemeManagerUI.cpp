@@ -296,6 +296,10 @@ void ThemeManagerUI::resetConfiguration()
 
 void ThemeManagerUI::commitConfiguration()
 {
+  // make sure pending changes are written to tempCfgFile
+  if ( config )
+    config->sync();
+
   // copy tempCfgFile to user config file
   QFile src(tempCfgFile);
   QFile dst(StyleConfig::getUserConfigFile());
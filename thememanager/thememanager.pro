@@ -7,15 +7,18 @@ TARGET = qsvgthememanager
 DESTDIR = bin
 TEMPLATE = app
 
-QT += core gui widgets
+QT += core gui widgets core5compat concurrent
 
 INCLUDEPATH += . ../styleconfig
 
 PRE_TARGETDEPS += \
-  ../styleconfig/lib/libQSvgStyleConfig.a
+  ../styleconfig/lib/libQSvgStyleConfig.a \
+  ../thirdparty/quazip/lib/libquazip.a
 
 LIBS += \
-  ../styleconfig/lib/libQSvgStyleConfig.a
+  ../styleconfig/lib/libQSvgStyleConfig.a \
+  ../thirdparty/quazip/lib/libquazip.a \
+  -lz
 
 HEADERS += \
   ThemeManagerUI.h